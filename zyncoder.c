@@ -206,6 +206,8 @@ void init_mcp23017(int base_pin, uint8_t i2c_address, uint8_t inta_pin, uint8_t
 //-----------------------------------------------------------------------------
 
 void send_zynswitch_midi(struct zynswitch_st *zynswitch, uint8_t status) {
+	//UI event source => switch index
+	uint8_t src=ZYNMIDI_SRC_SWITCH | ((zynswitch-zynswitches) & ZYNMIDI_SRC_INDEX_MASK);
 	if (zynswitch->midi_event.type==CTRL_CHANGE) {
 		uint8_t val=0;
 		if (status==0) val=127;
@@ -214,7 +216,7 @@ void send_zynswitch_midi(struct zynswitch_st *zynswitch, uint8_t status) {
 		//Update zyncoders
 		midi_event_zyncoders(zynswitch->midi_event.chan, zynswitch->midi_event.num, val);
 		//Send MIDI event to UI
-		write_zynmidi_ccontrol_change(zynswitch->midi_event.chan, zynswitch->midi_event.num, val);
+		write_zynmidi_src(src, 0, ZYNMIDI_PACK(0xB0 | zynswitch->midi_event.chan, zynswitch->midi_event.num, val));
 		//printf("Zyncoder: Zynswitch MIDI CC event (chan=%d, num=%d) => %d\n",zynswitch->midi_event.chan, zynswitch->midi_event.num, val);
 	}
 	else if (zynswitch->midi_event.type==NOTE_ON) {
@@ -222,14 +224,14 @@ void send_zynswitch_midi(struct zynswitch_st *zynswitch, uint8_t status) {
 			//Send MIDI event to engines and ouput (ZMOPS)
 			zynmidi_send_note_on(zynswitch->midi_event.chan, zynswitch->midi_event.num, 127);
 			//Send MIDI event to UI
-			write_zynmidi_note_on(zynswitch->midi_event.chan, zynswitch->midi_event.num, 127);
+			write_zynmidi_src(src, 0, ZYNMIDI_PACK(0x90 | zynswitch->midi_event.chan, zynswitch->midi_event.num, 127));
 			//printf("Zyncoder: Zynswitch MIDI Note-On event (chan=%d, num=%d) => %d\n",zynswitch->midi_event.chan, zynswitch->midi_event.num, 127);
 		}
 		else {
 			//Send MIDI event to engines and ouput (ZMOPS)
 			zynmidi_send_note_off(zynswitch->midi_event.chan, zynswitch->midi_event.num, 0);
 			//Send MIDI event to UI
-			write_zynmidi_note_off(zynswitch->midi_event.chan, zynswitch->midi_event.num, 0);
+			write_zynmidi_src(src, 0, ZYNMIDI_PACK(0x80 | zynswitch->midi_event.chan, zynswitch->midi_event.num, 0));
 			//printf("Zyncoder: Zynswitch MIDI Note-Off event (chan=%d, num=%d) => %d\n",zynswitch->midi_event.chan, zynswitch->midi_event.num, 0);
 		}
 	}
@@ -238,7 +240,7 @@ void send_zynswitch_midi(struct zynswitch_st *zynswitch, uint8_t status) {
 			//Send MIDI event to engines and ouput (ZMOPS)
 			zynmidi_send_program_change(zynswitch->midi_event.chan, zynswitch->midi_event.num);
 			//Send MIDI event to UI
-			write_zynmidi_program_change(zynswitch->midi_event.chan, zynswitch->midi_event.num);
+			write_zynmidi_src(src, 0, ZYNMIDI_PACK(0xC0 | zynswitch->midi_event.chan, zynswitch->midi_event.num, 0));
 			//printf("Zyncoder: Zynswitch MIDI Program Change event (chan=%d, num=%d)\n",zynswitch->midi_event.chan, zynswitch->midi_event.num);
 		}
 	}
@@ -401,6 +403,15 @@ int setup_zynswitch_midi(uint8_t i, uint8_t midi_evt, uint8_t midi_chan, uint8_t
 	return 1;
 }
 
+unsigned int get_status_zynswitch(uint8_t i) {
+	if (i >= MAX_NUM_ZYNSWITCHES) return 0;
+	return zynswitches[i].status;
+}
+
+int get_num_zynswitches() {
+	return MAX_NUM_ZYNSWITCHES;
+}
+
 unsigned int get_zynswitch_dtus(uint8_t i, unsigned int long_dtus) {
 	if (i >= MAX_NUM_ZYNSWITCHES) return 0;
 
@@ -448,8 +459,10 @@ void send_zyncoder(uint8_t i) {
 	if (zyncoder->midi_ctrl>0) {
 		//Send to MIDI output
 		zynmidi_send_ccontrol_change(zyncoder->midi_chan,zyncoder->midi_ctrl,zyncoder->value);
-		//Send to MIDI controller feedback => TODO: Reverse Mapping!!
-		//ctrlfb_send_ccontrol_change(zyncoder->midi_chan,zyncoder->midi_ctrl,zyncoder->value);
+		//Send to UI as extended record only => packed readers don't see it
+		write_zynmidi_src(ZYNMIDI_SRC_ENCODER | (i & ZYNMIDI_SRC_INDEX_MASK), ZYNMIDI_FLAG_EXT_ONLY, ZYNMIDI_PACK(0xB0 | zyncoder->midi_chan, zyncoder->midi_ctrl, zyncoder->value));
+		//Send to MIDI controller feedback => reverse-mapped by the router
+		ctrlfb_send_ccontrol_change(zyncoder->midi_chan,zyncoder->midi_ctrl,zyncoder->value);
 		//printf("Zyncoder: SEND MIDI CH#%d, CTRL %d = %d\n",zyncoder->midi_chan,zyncoder->midi_ctrl,zyncoder->value);
 	} else if (zyncoder->osc_lo_addr!=NULL && zyncoder->osc_path[0]) {
 		if (zyncoder->step >= 8) {
@@ -639,6 +652,10 @@ unsigned int get_value_zyncoder(uint8_t i) {
 	return zyncoders[i].value;
 }
 
+int get_num_zyncoders() {
+	return MAX_NUM_ZYNCODERS;
+}
+
 void set_value_zyncoder(uint8_t i, unsigned int v, int send) {
 	if (i >= MAX_NUM_ZYNCODERS) return;
 	struct zyncoder_st *zyncoder = zyncoders + i;
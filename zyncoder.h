@@ -65,6 +65,9 @@ struct zynswitch_st *setup_zynswitch(uint8_t i, uint8_t pin);
 int setup_zynswitch_midi(uint8_t i, uint8_t midi_evt, uint8_t midi_chan, uint8_t midi_cc);
 unsigned int get_zynswitch(uint8_t i, unsigned int long_dtus);
 unsigned int get_zynswitch_dtus(uint8_t i, unsigned int long_dtus);
+//Raw status & number of switches => No side effects
+unsigned int get_status_zynswitch(uint8_t i);
+int get_num_zynswitches();
 
 //-----------------------------------------------------------------------------
 // Rotary Encoders
@@ -106,5 +109,6 @@ void midi_event_zyncoders(uint8_t midi_chan, uint8_t midi_ctrl, uint8_t val);
 
 struct zyncoder_st *setup_zyncoder(uint8_t i, uint8_t pin_a, uint8_t pin_b, uint8_t midi_chan, uint8_t midi_ctrl, char *osc_path, unsigned int value, unsigned int max_value, unsigned int step); 
 unsigned int get_value_zyncoder(uint8_t i);
+int get_num_zyncoders();
 void set_value_zyncoder(uint8_t i, unsigned int v, int send);
 
@@ -24,8 +24,162 @@
 #********************************************************************
 
 from ctypes import *
+from time import sleep
 from os.path import dirname, realpath
-from numpy.ctypeslib import ndpointer
+import numpy as np
+from numpy.ctypeslib import ndpointer, as_array
+
+#-------------------------------------------------------------------------------
+# Zyncoder Library Data Structures
+#-------------------------------------------------------------------------------
+
+MAX_NUM_ZMOPS=21
+MAX_NUM_ZMIPS=5
+
+ZMIP_MAIN=0
+ZMIP_NET=1
+ZMIP_SEQ=2
+ZMIP_CTRL=3
+ZMIP_STEP=4
+
+MIDI_RT_CLOCK=1
+MIDI_RT_TRANSPORT=2
+MIDI_RT_ALL=3
+
+MIDI_STATUS_MASK_WORDS=8
+
+mf_clone_dtype=np.dtype([('enabled', np.int32), ('cc', np.uint8, (128,))])
+
+class zynmidi_stats_st(Structure):
+	_fields_ = [
+		('seq', c_uint32),
+		('cycles', c_uint32),
+		('zmip_events', c_uint32 * MAX_NUM_ZMIPS),
+		('zmop_events', c_uint32 * MAX_NUM_ZMOPS),
+		('ui_overflows', c_uint32)
+	]
+
+class midi_filter_snapshot_st(Structure):
+	_fields_ = [
+		('seq', c_uint32),
+		('master_chan', c_int),
+		('active_chan', c_int),
+		('preset', c_int),
+		('transpose', c_int * 16),
+		('clone', (c_ubyte * 16) * 16),
+		('last_pb_val', c_uint16 * 16),
+		('last_ctrl_val', (c_ubyte * 128) * 16),
+		('note_state', (c_ubyte * 128) * 16)
+	]
+
+MIDI_CURVE_LINEAR=0
+MIDI_CURVE_LOG=1
+MIDI_CURVE_EXP=2
+MIDI_CURVE_CUSTOM=3
+
+MIDI_VELOCITY_NOTE_ON=0
+MIDI_VELOCITY_NOTE_OFF=1
+
+MIDI_PROBE_HIST_SIZE=256
+
+class midi_probe_stats_st(Structure):
+	_fields_ = [
+		('sent', c_uint32),
+		('received', c_uint32),
+		('lost', c_uint32),
+		('min', c_uint32),
+		('max', c_uint32),
+		('sum', c_uint64),
+		('bin_frames', c_uint32),
+		('hist', c_uint32 * MIDI_PROBE_HIST_SIZE)
+	]
+
+ZYNMIDI_SRC_ZMIP=0x00
+ZYNMIDI_SRC_SWITCH=0x40
+ZYNMIDI_SRC_ENCODER=0x80
+ZYNMIDI_SRC_INTERNAL=0xC0
+ZYNMIDI_SRC_TYPE_MASK=0xC0
+ZYNMIDI_SRC_INDEX_MASK=0x3F
+
+ZYNMIDI_FLAG_LEARN=1
+ZYNMIDI_FLAG_MASTER=2
+ZYNMIDI_FLAG_EXT_ONLY=4
+ZYNMIDI_FLAG_HIRES=8
+
+MIDI_CTRL_ENC_AUTO=0
+MIDI_CTRL_ENC_ABSOLUTE=1
+MIDI_CTRL_ENC_OFFSET=2
+MIDI_CTRL_ENC_TWOS=3
+MIDI_CTRL_ENC_SIGNMAG=4
+MIDI_CTRL_ENC_INCDEC=5
+
+MIDI_HIRES_CC14=1
+MIDI_HIRES_NRPN=2
+
+class midi_clock_state_st(Structure):
+	_fields_ = [
+		('zmip', c_int),
+		('locked', c_ubyte),
+		('running', c_ubyte),
+		('bpm', c_double),
+		('frames_per_tick', c_double),
+		('jitter', c_double),
+		('tick_frame', c_uint32),
+		('tick_count', c_uint32)
+	]
+
+class midi_clock_gen_state_st(Structure):
+	_fields_ = [
+		('bpm', c_double),
+		('enabled', c_ubyte),
+		('running', c_ubyte),
+		('zmops', c_uint32),
+		('tick_count', c_uint32)
+	]
+
+class zynmidi_ui_event_st(Structure):
+	_fields_ = [
+		('time_us', c_uint64),
+		('src', c_ubyte),
+		('flags', c_ubyte),
+		('orig', c_ubyte * 3),
+		('data', c_ubyte * 3)
+	]
+
+class zynmidi_bcast_subscriber_st(Structure):
+	_fields_ = [
+		('active', c_uint32),
+		('pid', c_int),
+		('cursor', c_uint64),
+		('overflows', c_uint32),
+		('lag', c_uint32),
+		('max_lag', c_uint32)
+	]
+
+ZYNMIDI_STATE_MAX_ENCODERS=32
+ZYNMIDI_STATE_MAX_SWITCHES=64
+
+class zynmidi_state_data_st(Structure):
+	_fields_ = [
+		('gen', c_uint32),
+		('n_encoders', c_uint32),
+		('n_switches', c_uint32),
+		('ctrl_gen', c_uint32 * 16),
+		('note_gen', c_uint32 * 16),
+		('pb_gen', c_uint32),
+		('encoder_gen', c_uint32),
+		('switch_gen', c_uint32),
+		('ctrl_dirty', (c_uint32 * 4) * 16),
+		('note_dirty', (c_uint32 * 4) * 16),
+		('pb_dirty', c_uint32),
+		('encoder_dirty', c_uint32),
+		('switch_dirty', c_uint32 * (ZYNMIDI_STATE_MAX_SWITCHES//32)),
+		('last_pb_val', c_uint16 * 16),
+		('last_ctrl_val', (c_ubyte * 128) * 16),
+		('note_state', (c_ubyte * 128) * 16),
+		('encoder_value', c_uint32 * ZYNMIDI_STATE_MAX_ENCODERS),
+		('switch_status', c_ubyte * ZYNMIDI_STATE_MAX_SWITCHES)
+	]
 
 #-------------------------------------------------------------------------------
 # Zyncoder Library Wrapper
@@ -42,6 +196,48 @@ def lib_zyncoder_init():
 		lib_zyncoder.init_zynlib()
 		#Setup return type for some functions
 		lib_zyncoder.get_midi_filter_clone_cc.restype = ndpointer(dtype=c_ubyte, shape=(128,))
+		lib_zyncoder.get_midi_filter_last_ctrl_val_array.restype = ndpointer(dtype=c_ubyte, shape=(16,128))
+		lib_zyncoder.get_midi_filter_note_state_array.restype = ndpointer(dtype=c_ubyte, shape=(16,128))
+		lib_zyncoder.get_midi_filter_last_pb_val_array.restype = ndpointer(dtype=c_uint16, shape=(16,))
+		lib_zyncoder.get_midi_filter_transpose_array.restype = ndpointer(dtype=c_int, shape=(16,))
+		lib_zyncoder.get_midi_filter_clone_array.restype = ndpointer(dtype=mf_clone_dtype, shape=(16,16))
+		lib_zyncoder.get_midi_filter_velocity_lut.restype = POINTER(c_ubyte * 128)
+		lib_zyncoder.set_midi_filter_velocity_lut.argtypes = [c_ubyte, c_int, POINTER(c_ubyte * 128)]
+		lib_zyncoder.get_zynmidi_stats.restype = POINTER(zynmidi_stats_st)
+		lib_zyncoder.get_midi_clock_state.argtypes = [POINTER(midi_clock_state_st)]
+		lib_zyncoder.get_midi_clock_bpm.restype = c_double
+		lib_zyncoder.get_midi_clock_phase.argtypes = [c_uint32]
+		lib_zyncoder.get_midi_clock_phase.restype = c_double
+		lib_zyncoder.set_midi_clock_gen_bpm.argtypes = [c_double]
+		lib_zyncoder.get_midi_clock_gen_bpm.restype = c_double
+		lib_zyncoder.set_midi_clock_gen_zmops.argtypes = [c_uint32]
+		lib_zyncoder.set_midi_clock_gen_transport.argtypes = [c_ubyte]
+		lib_zyncoder.get_midi_clock_gen_state.argtypes = [POINTER(midi_clock_gen_state_st)]
+		lib_zyncoder.schedule_midi_event.argtypes = [c_int, c_uint32, POINTER(c_ubyte), c_int]
+		lib_zyncoder.schedule_midi_event_delay.argtypes = [c_int, c_uint32, POINTER(c_ubyte), c_int]
+		lib_zyncoder.schedule_midi_note.argtypes = [c_int, c_ubyte, c_ubyte, c_ubyte, c_uint32, c_uint32]
+		lib_zyncoder.get_midi_sched_frame.restype = c_uint32
+		lib_zyncoder.get_midi_sched_dropped.restype = c_uint32
+		lib_zyncoder.load_midi_player.argtypes = [c_char_p]
+		lib_zyncoder.seek_midi_player.argtypes = [c_uint32]
+		lib_zyncoder.get_midi_player_position.restype = c_uint32
+		lib_zyncoder.get_midi_player_length.restype = c_uint32
+		for f in ('zmip_set_status_mask', 'zmip_get_status_mask', 'zmop_set_status_mask', 'zmop_get_status_mask'):
+			getattr(lib_zyncoder, f).argtypes = [c_int, POINTER(c_uint32 * MIDI_STATUS_MASK_WORDS)]
+		lib_zyncoder.get_midi_filter_snapshot.argtypes = [POINTER(midi_filter_snapshot_st)]
+		lib_zyncoder.get_midi_probe_stats.restype = POINTER(midi_probe_stats_st)
+		lib_zyncoder.read_zynmidi_ext.argtypes = [POINTER(zynmidi_ui_event_st)]
+		lib_zyncoder.get_zynmidi_time_us.restype = c_uint64
+		lib_zyncoder.zynmidi_bcast_attach.restype = c_void_p
+		lib_zyncoder.zynmidi_bcast_detach.argtypes = [c_void_p]
+		lib_zyncoder.zynmidi_bcast_subscribe.argtypes = [c_void_p]
+		lib_zyncoder.zynmidi_bcast_unsubscribe.argtypes = [c_void_p, c_int]
+		lib_zyncoder.zynmidi_bcast_read.argtypes = [c_void_p, c_int, POINTER(zynmidi_ui_event_st)]
+		lib_zyncoder.get_zynmidi_bcast_subscriber.argtypes = [c_void_p, c_int]
+		lib_zyncoder.get_zynmidi_bcast_subscriber.restype = POINTER(zynmidi_bcast_subscriber_st)
+		lib_zyncoder.zynmidi_state_attach.restype = c_void_p
+		lib_zyncoder.zynmidi_state_detach.argtypes = [c_void_p]
+		lib_zyncoder.get_zynmidi_state_snapshot.argtypes = [c_void_p, POINTER(zynmidi_state_data_st)]
 
 	except Exception as e:
 		lib_zyncoder=None
@@ -54,3 +250,244 @@ def get_lib_zyncoder():
 	return lib_zyncoder
 
 #-------------------------------------------------------------------------------
+# Router State Views
+#-------------------------------------------------------------------------------
+# Zero-copy views over the router state arrays. They are updated by the RT
+# thread, so use read_router_state() or get_midi_filter_snapshot() when a
+# consistent copy is needed.
+#-------------------------------------------------------------------------------
+
+def get_zynmidi_stats():
+	return lib_zyncoder.get_zynmidi_stats().contents
+
+
+def get_midi_filter_views():
+	return {
+		'last_ctrl_val': lib_zyncoder.get_midi_filter_last_ctrl_val_array(),
+		'note_state': lib_zyncoder.get_midi_filter_note_state_array(),
+		'last_pb_val': lib_zyncoder.get_midi_filter_last_pb_val_array(),
+		'transpose': lib_zyncoder.get_midi_filter_transpose_array(),
+		'clone': lib_zyncoder.get_midi_filter_clone_array()
+	}
+
+
+# Call read_func until it returns without a concurrent RT update (seqlock)
+def read_router_state(read_func, retries=1000):
+	stats=get_zynmidi_stats()
+	for i in range(retries):
+		seq=stats.seq
+		if seq & 1:
+			sleep(0.0001)
+			continue
+		res=read_func()
+		if stats.seq==seq:
+			return res
+	return None
+
+
+# Consistent copy of the whole MIDI filter state, in one call
+def get_midi_filter_snapshot():
+	snap=midi_filter_snapshot_st()
+	if lib_zyncoder.get_midi_filter_snapshot(byref(snap)):
+		return snap
+
+
+def get_midi_filter_snapshot_arrays(snap):
+	return {
+		'transpose': as_array(snap.transpose),
+		'clone': as_array(snap.clone),
+		'last_pb_val': as_array(snap.last_pb_val),
+		'last_ctrl_val': as_array(snap.last_ctrl_val),
+		'note_state': as_array(snap.note_state)
+	}
+
+#-------------------------------------------------------------------------------
+# Velocity Curves
+#-------------------------------------------------------------------------------
+
+# Preset curves => (curve, min, max)
+midi_velocity_curves={
+	'linear': (MIDI_CURVE_LINEAR, 0, 127),
+	'soft': (MIDI_CURVE_LOG, 0, 127),
+	'hard': (MIDI_CURVE_EXP, 0, 127),
+	'compressed': (MIDI_CURVE_LINEAR, 32, 112),
+	'fixed': (MIDI_CURVE_LINEAR, 100, 100)
+}
+
+# Set the velocity curve of a channel (chan=None => all channels). The curve can
+# be a preset name, a (curve, min, max) tuple or a list of 128 values. None => bypass.
+def set_midi_velocity_curve(chan, curve, vtype=MIDI_VELOCITY_NOTE_ON):
+	if chan is None:
+		chan=0xFF
+	if curve is None:
+		lib_zyncoder.reset_midi_filter_velocity_curve(chan, vtype)
+		return True
+	if isinstance(curve, str):
+		curve=midi_velocity_curves[curve]
+	if len(curve)==128:
+		lut=(c_ubyte * 128)(*[int(v) & 0x7F for v in curve])
+		return bool(lib_zyncoder.set_midi_filter_velocity_lut(chan, vtype, byref(lut)))
+	return bool(lib_zyncoder.set_midi_filter_velocity_curve(chan, vtype, curve[0], curve[1], curve[2]))
+
+
+# Active velocity LUT of a channel => numpy array or None if bypassed
+def get_midi_velocity_curve(chan, vtype=MIDI_VELOCITY_NOTE_ON):
+	lut=lib_zyncoder.get_midi_filter_velocity_lut(chan, vtype)
+	if lut:
+		return np.array(lut.contents)
+
+#-------------------------------------------------------------------------------
+# UI Events
+#-------------------------------------------------------------------------------
+
+# Decode an aggregated high-resolution record => (chan, kind, param, value14)
+# kind is 'cc' (param is the MSB controller), 'nrpn' or 'rpn'
+def decode_zynmidi_hires(ev):
+	chan=ev.data[0] & 0xF
+	value=(ev.data[2] << 7) | ev.orig[0]
+	if ev.data[1]==99:
+		return (chan, 'nrpn', (ev.orig[1] << 7) | ev.orig[2], value)
+	elif ev.data[1]==101:
+		return (chan, 'rpn', (ev.orig[1] << 7) | ev.orig[2], value)
+	return (chan, 'cc', ev.data[1], value)
+
+
+# Read all pending UI event records => list of zynmidi_ui_event_st
+def read_zynmidi_ext():
+	res=[]
+	ev=zynmidi_ui_event_st()
+	while lib_zyncoder.read_zynmidi_ext(byref(ev)):
+		res.append(ev)
+		ev=zynmidi_ui_event_st()
+	return res
+
+# Subscriber to the UI event broadcast => each one gets the full stream
+class zynmidi_bcast_reader():
+
+	def __init__(self):
+		self.bcast=lib_zyncoder.zynmidi_bcast_attach()
+		if not self.bcast:
+			raise Exception("Can't attach to UI event broadcast")
+		self.isub=lib_zyncoder.zynmidi_bcast_subscribe(self.bcast)
+		if self.isub<0:
+			lib_zyncoder.zynmidi_bcast_detach(self.bcast)
+			raise Exception("No free UI event broadcast subscriber slots")
+
+
+	def close(self):
+		if self.bcast:
+			lib_zyncoder.zynmidi_bcast_unsubscribe(self.bcast, self.isub)
+			lib_zyncoder.zynmidi_bcast_detach(self.bcast)
+			self.bcast=None
+
+
+	def read(self):
+		res=[]
+		ev=zynmidi_ui_event_st()
+		while lib_zyncoder.zynmidi_bcast_read(self.bcast, self.isub, byref(ev)):
+			res.append(ev)
+			ev=zynmidi_ui_event_st()
+		return res
+
+
+	def get_stats(self):
+		sub=lib_zyncoder.get_zynmidi_bcast_subscriber(self.bcast, self.isub).contents
+		return {
+			'overflows': sub.overflows,
+			'lag': sub.lag,
+			'max_lag': sub.max_lag
+		}
+
+#-------------------------------------------------------------------------------
+# Exported State
+#-------------------------------------------------------------------------------
+
+# Reader for the state exported to shared memory => works from any process
+class zynmidi_state_reader():
+
+	def __init__(self):
+		self.state=lib_zyncoder.zynmidi_state_attach()
+		if not self.state:
+			raise Exception("Can't attach to exported state")
+
+
+	def close(self):
+		if self.state:
+			lib_zyncoder.zynmidi_state_detach(self.state)
+			self.state=None
+
+
+	# Consistent copy of the state => zynmidi_state_data_st or None
+	def get_snapshot(self):
+		snap=zynmidi_state_data_st()
+		if lib_zyncoder.get_zynmidi_state_snapshot(self.state, byref(snap)):
+			return snap
+
+#-------------------------------------------------------------------------------
+# MIDI Clock
+#-------------------------------------------------------------------------------
+
+# Tempo & phase estimated from incoming MIDI clock => None if busy
+def get_midi_clock_state():
+	state=midi_clock_state_st()
+	if lib_zyncoder.get_midi_clock_state(byref(state)):
+		return state
+
+# Internal clock generator state
+def get_midi_clock_gen_state():
+	state=midi_clock_gen_state_st()
+	lib_zyncoder.get_midi_clock_gen_state(byref(state))
+	return state
+
+#-------------------------------------------------------------------------------
+# Port Status Masks
+#-------------------------------------------------------------------------------
+
+# Status bytes accepted by a port, as a list of 256 booleans
+def get_port_status_mask(izmip=None, izmop=None):
+	mask=(c_uint32 * MIDI_STATUS_MASK_WORDS)()
+	if izmip is not None:
+		lib_zyncoder.zmip_get_status_mask(izmip, byref(mask))
+	else:
+		lib_zyncoder.zmop_get_status_mask(izmop, byref(mask))
+	return [bool(mask[i >> 5] & (1 << (i & 0x1F))) for i in range(256)]
+
+#-------------------------------------------------------------------------------
+# MIDI Scheduler
+#-------------------------------------------------------------------------------
+
+# Schedule a MIDI event (list of bytes) for an absolute jack frame time
+def schedule_midi_event(izmip, frame, data):
+	buf=(c_ubyte * 3)(*data)
+	return lib_zyncoder.schedule_midi_event(izmip, frame & 0xFFFFFFFF, buf, len(data))
+
+# Schedule a MIDI event (list of bytes) after a delay in microseconds
+def schedule_midi_event_delay(izmip, delay_us, data):
+	buf=(c_ubyte * 3)(*data)
+	return lib_zyncoder.schedule_midi_event_delay(izmip, delay_us, buf, len(data))
+
+#-------------------------------------------------------------------------------
+# MIDI Latency Probe
+#-------------------------------------------------------------------------------
+
+# Consistent copy of the probe stats, with the histogram as a numpy array
+def get_midi_probe_stats():
+	stats=lib_zyncoder.get_midi_probe_stats().contents
+	def read_stats():
+		res=midi_probe_stats_st()
+		memmove(byref(res), byref(stats), sizeof(res))
+		return res
+	res=read_router_state(read_stats)
+	if res:
+		return {
+			'sent': res.sent,
+			'received': res.received,
+			'lost': res.lost,
+			'min': res.min if res.received else None,
+			'max': res.max if res.received else None,
+			'avg': res.sum/res.received if res.received else None,
+			'bin_frames': res.bin_frames,
+			'hist': np.array(res.hist)
+		}
+
+#-------------------------------------------------------------------------------
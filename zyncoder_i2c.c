@@ -118,7 +118,7 @@ void update_zynswitch(uint8_t i, uint8_t status) {
 		//Update zyncoders
 		midi_event_zyncoders(zynswitch->midi_chan, zynswitch->midi_cc, val);
 		//Send MIDI event to UI
-		write_zynmidi_ccontrol_change(zynswitch->midi_chan, zynswitch->midi_cc, val);
+		write_zynmidi_src(ZYNMIDI_SRC_SWITCH | (i & ZYNMIDI_SRC_INDEX_MASK), 0, ZYNMIDI_PACK(0xB0 | zynswitch->midi_chan, zynswitch->midi_cc, val));
 	}
 
 	struct timespec ts;
@@ -177,6 +177,15 @@ int setup_zynswitch_midi(uint8_t i, uint8_t midi_chan, uint8_t midi_cc) {
 	return 1;
 }
 
+unsigned int get_status_zynswitch(uint8_t i) {
+	if (i >= MAX_NUM_ZYNSWITCHES) return 0;
+	return zynswitches[i].status;
+}
+
+int get_num_zynswitches() {
+	return MAX_NUM_ZYNSWITCHES;
+}
+
 /** @brief  Get the duration of last switch press and release
 *   @param  i Virtual switch index
 *   @param  long_dtus Timeout for long press (us)
@@ -241,7 +250,9 @@ void send_zyncoder(uint8_t i) {
 	if (zyncoder->midi_ctrl>0) {
 		//Send to MIDI output
 		zynmidi_send_ccontrol_change(zyncoder->midi_chan,zyncoder->midi_ctrl,zyncoder->value);
-		//Send to MIDI controller feedback => TODO: Reverse Mapping!!
+		//Send to UI as extended record only => packed readers don't see it
+		write_zynmidi_src(ZYNMIDI_SRC_ENCODER | (i & ZYNMIDI_SRC_INDEX_MASK), ZYNMIDI_FLAG_EXT_ONLY, ZYNMIDI_PACK(0xB0 | zyncoder->midi_chan, zyncoder->midi_ctrl, zyncoder->value));
+		//Send to MIDI controller feedback => reverse-mapped by the router
 		ctrlfb_send_ccontrol_change(zyncoder->midi_chan,zyncoder->midi_ctrl,zyncoder->value);
 		//printf("SEND MIDI CHAN %d, CTRL %d = %d\n",zyncoder->midi_chan,zyncoder->midi_ctrl,zyncoder->value);
 	} else if (zyncoder->osc_lo_addr!=NULL && zyncoder->osc_path[0]) {
@@ -319,6 +330,10 @@ unsigned int get_value_zyncoder(uint8_t i) {
 	return zyncoders[i].value;
 }
 
+int get_num_zyncoders() {
+	return MAX_NUM_ZYNCODERS;
+}
+
 /** @brief  Set absolute value of rotary encoder
 *   @param  i Encoder index
 *   @param  v Value
@@ -0,0 +1,103 @@
+/*
+ * ******************************************************************
+ * ZYNTHIAN PROJECT: ZynMidiRouter Replay Tool
+ * 
+ * Replays a MIDI capture log or SMF through the router, offline
+ * (faster than real time) or under jack, and compares the output
+ * with a golden capture log.
+ * 
+ * Copyright (C) 2015-2018 Fernando Moyano <jofemodo@zynthian.org>
+ *
+ * ******************************************************************
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * For a full copy of the GNU General Public License see the LICENSE.txt file.
+ * 
+ * ******************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "zynmidirouter.h"
+#include "zynmidicapture.h"
+#include "zynmidireplay.h"
+
+void usage(char *name) {
+	fprintf(stderr, "Usage: %s [-j] [-z zmip] [-r sample_rate] [-b buffer_size] [-m zmops_mask] [-o output.log] [-g golden.log] [-G] input.(log|mid)\n", name);
+	fprintf(stderr, "  -j: replay under jack (output ports must be connected). Default is offline.\n");
+	fprintf(stderr, "  -z: inject all events into this zmip. Default is the recorded zmip/port.\n");
+	fprintf(stderr, "  -r, -b: offline sample rate & buffer size. Default is the recorded ones.\n");
+	fprintf(stderr, "  -m: zmops to capture & compare. Default is all.\n");
+	fprintf(stderr, "  -G: use generic zmip processing, instead of flag-specialized (for benchmarking).\n");
+}
+
+int main(int argc, char *argv[]) {
+	int opt;
+	int jack_mode=0;
+	int izmip=-1;
+	int generic=0;
+	uint32_t sample_rate=0;
+	uint32_t buffer_size=0;
+	uint32_t zmops_mask=(1<<MAX_NUM_ZMOPS)-1;
+	char *out_fpath=NULL;
+	char *golden_fpath=NULL;
+
+	while ((opt=getopt(argc, argv, "jz:r:b:m:o:g:G"))!=-1) {
+		switch (opt) {
+			case 'j': jack_mode=1; break;
+			case 'z': izmip=atoi(optarg); break;
+			case 'r': sample_rate=atoi(optarg); break;
+			case 'b': buffer_size=atoi(optarg); break;
+			case 'm': zmops_mask=strtoul(optarg, NULL, 0); break;
+			case 'o': out_fpath=optarg; break;
+			case 'g': golden_fpath=optarg; break;
+			case 'G': generic=1; break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if (optind>=argc) {
+		usage(argv[0]);
+		return 1;
+	}
+	char *in_fpath=argv[optind];
+	//A golden log needs an output log to compare
+	if (golden_fpath && !out_fpath) out_fpath="/tmp/zynmidi_replay.log";
+
+	if (jack_mode) {
+		if (!init_zynmidirouter()) return 2;
+		if (generic) set_zmip_specialized(0);
+		if (!load_midi_replay(in_fpath, izmip)) return 2;
+		if (out_fpath && !start_midi_capture(out_fpath, MIDI_CAPTURE_FORMAT_LOG, 0, zmops_mask)) return 2;
+		if (!start_midi_replay()) return 2;
+		while (is_midi_replay_running()) usleep(10000);
+		//Wait for the last cycle
+		usleep(100000);
+		if (out_fpath) stop_midi_capture();
+		fprintf(stdout, "Replayed %d events\n", get_midi_replay_num_events());
+		end_zynmidirouter();
+	} else {
+		if (!init_zynmidirouter_offline(sample_rate, buffer_size)) return 2;
+		if (generic) set_zmip_specialized(0);
+		if (!replay_midi_offline(in_fpath, out_fpath, zmops_mask, izmip)) return 2;
+	}
+
+	if (golden_fpath) {
+		int n_diffs=diff_midi_capture(out_fpath, golden_fpath, zmops_mask);
+		if (n_diffs!=0) return 3;
+	}
+	return 0;
+}
@@ -0,0 +1,205 @@
+/*
+ * ******************************************************************
+ * ZYNTHIAN PROJECT: ZynMidiRouter Library
+ * 
+ * UI event broadcast: Multi-consumer ring in shared memory
+ * 
+ * Copyright (C) 2015-2018 Fernando Moyano <jofemodo@zynthian.org>
+ *
+ * ******************************************************************
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * For a full copy of the GNU General Public License see the LICENSE.txt file.
+ * 
+ * ******************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "zynmidirouter.h"
+#include "zynmidibcast.h"
+
+//-----------------------------------------------------------------------------
+// Producer
+//-----------------------------------------------------------------------------
+
+struct zynmidi_bcast_st *zynmidi_bcast=NULL;
+
+int init_zynmidi_bcast() {
+	//Start with a fresh segment => readers attached to the old one just stop receiving
+	shm_unlink(ZYNMIDI_BCAST_SHM_NAME);
+	int fd=shm_open(ZYNMIDI_BCAST_SHM_NAME, O_CREAT|O_EXCL|O_RDWR, 0666);
+	if (fd<0) {
+		fprintf (stderr, "ZynMidiRouter: Can't create UI broadcast shared memory (%s).\n", strerror(errno));
+		return 0;
+	}
+	//Subscribers must be able to update their cursors, whatever the umask
+	fchmod(fd, 0666);
+	if (ftruncate(fd, sizeof(struct zynmidi_bcast_st))) {
+		fprintf (stderr, "ZynMidiRouter: Can't size UI broadcast shared memory.\n");
+		close(fd);
+		shm_unlink(ZYNMIDI_BCAST_SHM_NAME);
+		return 0;
+	}
+	struct zynmidi_bcast_st *bcast=mmap(NULL, sizeof(struct zynmidi_bcast_st), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (bcast==MAP_FAILED) {
+		fprintf (stderr, "ZynMidiRouter: Can't map UI broadcast shared memory.\n");
+		shm_unlink(ZYNMIDI_BCAST_SHM_NAME);
+		return 0;
+	}
+	if (mlock(bcast, sizeof(struct zynmidi_bcast_st))) {
+		fprintf (stderr, "ZynMidiRouter: Error locking memory for UI broadcast ring.\n");
+	}
+	//Segment is zero-filled => set header, magic last
+	bcast->version=ZYNMIDI_BCAST_VERSION;
+	bcast->size=ZYNMIDI_BCAST_SIZE;
+	bcast->max_subscribers=ZYNMIDI_BCAST_MAX_SUBSCRIBERS;
+	bcast->head=0;
+	__atomic_store_n(&bcast->magic, ZYNMIDI_BCAST_MAGIC, __ATOMIC_RELEASE);
+	zynmidi_bcast=bcast;
+	return 1;
+}
+
+int end_zynmidi_bcast() {
+	struct zynmidi_bcast_st *bcast=zynmidi_bcast;
+	if (!bcast) return 0;
+	zynmidi_bcast=NULL;
+	munmap(bcast, sizeof(struct zynmidi_bcast_st));
+	shm_unlink(ZYNMIDI_BCAST_SHM_NAME);
+	return 1;
+}
+
+void zynmidi_bcast_write(const struct zynmidi_ui_event_st *ev) {
+	struct zynmidi_bcast_st *bcast=zynmidi_bcast;
+	if (!bcast) return;
+	uint64_t seq=__atomic_fetch_add(&bcast->head, 1, __ATOMIC_ACQ_REL);
+	struct zynmidi_bcast_slot_st *slot=bcast->slots + (seq & (ZYNMIDI_BCAST_SIZE-1));
+	__atomic_store_n(&slot->stamp, 2*seq+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->event=*ev;
+	__atomic_store_n(&slot->stamp, 2*seq+2, __ATOMIC_RELEASE);
+}
+
+//-----------------------------------------------------------------------------
+// Consumers
+//-----------------------------------------------------------------------------
+
+struct zynmidi_bcast_st *zynmidi_bcast_attach() {
+	int fd=shm_open(ZYNMIDI_BCAST_SHM_NAME, O_RDWR, 0);
+	if (fd<0) {
+		fprintf (stderr, "ZynMidiRouter: Can't open UI broadcast shared memory (%s).\n", strerror(errno));
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size<sizeof(struct zynmidi_bcast_st)) {
+		fprintf (stderr, "ZynMidiRouter: UI broadcast shared memory has wrong size.\n");
+		close(fd);
+		return NULL;
+	}
+	struct zynmidi_bcast_st *bcast=mmap(NULL, sizeof(struct zynmidi_bcast_st), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (bcast==MAP_FAILED) {
+		fprintf (stderr, "ZynMidiRouter: Can't map UI broadcast shared memory.\n");
+		return NULL;
+	}
+	if (__atomic_load_n(&bcast->magic, __ATOMIC_ACQUIRE)!=ZYNMIDI_BCAST_MAGIC || bcast->version!=ZYNMIDI_BCAST_VERSION) {
+		fprintf (stderr, "ZynMidiRouter: UI broadcast shared memory is not valid.\n");
+		munmap(bcast, sizeof(struct zynmidi_bcast_st));
+		return NULL;
+	}
+	return bcast;
+}
+
+int zynmidi_bcast_detach(struct zynmidi_bcast_st *bcast) {
+	if (!bcast) return 0;
+	munmap(bcast, sizeof(struct zynmidi_bcast_st));
+	return 1;
+}
+
+int zynmidi_bcast_subscribe(struct zynmidi_bcast_st *bcast) {
+	if (!bcast) return -1;
+	int i;
+	for (i=0;i<ZYNMIDI_BCAST_MAX_SUBSCRIBERS;i++) {
+		struct zynmidi_bcast_subscriber_st *sub=bcast->subscribers+i;
+		uint32_t active=__atomic_load_n(&sub->active, __ATOMIC_ACQUIRE);
+		//Reclaim slots left by dead processes
+		if (active && kill(sub->pid, 0)<0 && errno==ESRCH) {
+			__atomic_compare_exchange_n(&sub->active, &active, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+		}
+		uint32_t free_slot=0;
+		if (__atomic_compare_exchange_n(&sub->active, &free_slot, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			sub->pid=getpid();
+			sub->overflows=0;
+			sub->lag=0;
+			sub->max_lag=0;
+			//Start with the next event
+			sub->cursor=__atomic_load_n(&bcast->head, __ATOMIC_ACQUIRE);
+			return i;
+		}
+	}
+	fprintf (stderr, "ZynMidiRouter: No free UI broadcast subscriber slots.\n");
+	return -1;
+}
+
+int zynmidi_bcast_unsubscribe(struct zynmidi_bcast_st *bcast, int isub) {
+	if (!bcast || isub<0 || isub>=ZYNMIDI_BCAST_MAX_SUBSCRIBERS) return 0;
+	__atomic_store_n(&bcast->subscribers[isub].active, 0, __ATOMIC_RELEASE);
+	return 1;
+}
+
+int zynmidi_bcast_read(struct zynmidi_bcast_st *bcast, int isub, struct zynmidi_ui_event_st *ev) {
+	if (!bcast || isub<0 || isub>=ZYNMIDI_BCAST_MAX_SUBSCRIBERS) return 0;
+	struct zynmidi_bcast_subscriber_st *sub=bcast->subscribers+isub;
+	uint64_t cursor=sub->cursor;
+	while (1) {
+		struct zynmidi_bcast_slot_st *slot=bcast->slots + (cursor & (ZYNMIDI_BCAST_SIZE-1));
+		uint64_t stamp=__atomic_load_n(&slot->stamp, __ATOMIC_ACQUIRE);
+		//Not written yet
+		if (stamp<2*cursor+2) break;
+		if (stamp==2*cursor+2) {
+			*ev=slot->event;
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			//Not rewritten while copying => done
+			if (__atomic_load_n(&slot->stamp, __ATOMIC_RELAXED)==stamp) {
+				sub->cursor=++cursor;
+				uint64_t head=__atomic_load_n(&bcast->head, __ATOMIC_ACQUIRE);
+				sub->lag=(head>cursor) ? head-cursor : 0;
+				if (sub->lag>sub->max_lag) sub->max_lag=sub->lag;
+				return 1;
+			}
+		}
+		//Overrun => skip to the oldest events, leaving some room for the writers
+		uint64_t head=__atomic_load_n(&bcast->head, __ATOMIC_ACQUIRE);
+		uint64_t oldest=head - ZYNMIDI_BCAST_SIZE + ZYNMIDI_BCAST_SIZE/4;
+		if (head<ZYNMIDI_BCAST_SIZE || oldest<=cursor) oldest=cursor+1;
+		sub->overflows+=oldest-cursor;
+		sub->cursor=cursor=oldest;
+	}
+	return 0;
+}
+
+struct zynmidi_bcast_subscriber_st *get_zynmidi_bcast_subscriber(struct zynmidi_bcast_st *bcast, int isub) {
+	if (!bcast || isub<0 || isub>=ZYNMIDI_BCAST_MAX_SUBSCRIBERS) return NULL;
+	return bcast->subscribers+isub;
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,101 @@
+/*
+ * ******************************************************************
+ * ZYNTHIAN PROJECT: ZynMidiRouter Library
+ * 
+ * UI event broadcast: Multi-consumer ring in shared memory
+ * 
+ * Copyright (C) 2015-2018 Fernando Moyano <jofemodo@zynthian.org>
+ *
+ * ******************************************************************
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * For a full copy of the GNU General Public License see the LICENSE.txt file.
+ * 
+ * ******************************************************************
+ */
+
+#include <stdint.h>
+#include <sys/types.h>
+
+//-----------------------------------------------------------------------------
+// UI Event Broadcast
+//-----------------------------------------------------------------------------
+//	+ Every UI event record (see write_zynmidi_ext) is also published to a
+//	  ring in POSIX shared memory, so several readers, in this or in other
+//	  processes, get the full stream. zynmidi_buffer is still drained by the
+//	  main UI through read_zynmidi.
+//	+ Writers never wait for readers: a slow subscriber is overrun, and the
+//	  lost events are added to its overflow counter.
+//	+ Each slot has a sequence stamp (seqlock), so readers detect slots that
+//	  are being rewritten while they copy them. Slots are reserved with an
+//	  atomic counter, as events come from the RT thread and from the
+//	  switches thread.
+//	+ Each subscriber has its own cursor, overflow & lag counters, in the
+//	  shared segment, so they can be monitored from any process.
+//	+ Needs zynmidirouter.h (struct zynmidi_ui_event_st).
+//-----------------------------------------------------------------------------
+
+#define ZYNMIDI_BCAST_SHM_NAME "/zynmidi_ui"
+#define ZYNMIDI_BCAST_MAGIC 0x5A554942
+#define ZYNMIDI_BCAST_VERSION 1
+//Must be a power of 2
+#define ZYNMIDI_BCAST_SIZE 4096
+#define ZYNMIDI_BCAST_MAX_SUBSCRIBERS 8
+
+struct zynmidi_bcast_slot_st {
+	//Seqlock => 2*seq+1 while writing event #seq, 2*seq+2 when written
+	volatile uint64_t stamp;
+	struct zynmidi_ui_event_st event;
+};
+
+struct zynmidi_bcast_subscriber_st {
+	volatile uint32_t active;
+	volatile pid_t pid;
+	//Sequence number of next event to read
+	volatile uint64_t cursor;
+	//Events lost because the subscriber was overrun
+	volatile uint32_t overflows;
+	//Events pending when last read & max value
+	volatile uint32_t lag;
+	volatile uint32_t max_lag;
+};
+
+struct zynmidi_bcast_st {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	uint32_t max_subscribers;
+	//Sequence number of next event to write
+	volatile uint64_t head;
+	struct zynmidi_bcast_subscriber_st subscribers[ZYNMIDI_BCAST_MAX_SUBSCRIBERS];
+	struct zynmidi_bcast_slot_st slots[ZYNMIDI_BCAST_SIZE];
+};
+
+//Producer side => Called from init_zynmidirouter / end_zynmidirouter
+int init_zynmidi_bcast();
+int end_zynmidi_bcast();
+
+//Publish an event. RT safe, never blocks.
+void zynmidi_bcast_write(const struct zynmidi_ui_event_st *ev);
+
+//Consumer side => Map the segment (NULL if error) & subscribe (-1 if no free slots)
+struct zynmidi_bcast_st *zynmidi_bcast_attach();
+int zynmidi_bcast_detach(struct zynmidi_bcast_st *bcast);
+int zynmidi_bcast_subscribe(struct zynmidi_bcast_st *bcast);
+int zynmidi_bcast_unsubscribe(struct zynmidi_bcast_st *bcast, int isub);
+
+//Read next event => Return 1 if read, 0 if none
+int zynmidi_bcast_read(struct zynmidi_bcast_st *bcast, int isub, struct zynmidi_ui_event_st *ev);
+
+struct zynmidi_bcast_subscriber_st *get_zynmidi_bcast_subscriber(struct zynmidi_bcast_st *bcast, int isub);
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,336 @@
+/*
+ * ******************************************************************
+ * ZYNTHIAN PROJECT: ZynMidiRouter Library
+ * 
+ * MIDI capture: Records the events passing through the router ports
+ * 
+ * Copyright (C) 2015-2018 Fernando Moyano <jofemodo@zynthian.org>
+ *
+ * ******************************************************************
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * For a full copy of the GNU General Public License see the LICENSE.txt file.
+ * 
+ * ******************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <jack/jack.h>
+#include <jack/ringbuffer.h>
+
+#include "zynmidirouter.h"
+#include "zynmidicapture.h"
+#include "zynsmf.h"
+
+//-----------------------------------------------------------------------------
+// Capture File => Memory-mapped, append-only
+//-----------------------------------------------------------------------------
+
+struct midi_capture_file_st {
+	int fd;
+	int format;
+	uint8_t *map;
+	off_t map_offset;
+	off_t pos;
+	uint32_t sample_rate;
+	jack_nframes_t start_frame;
+	uint32_t last_tick;
+	int last_port;
+};
+
+int midi_capture_file_write(struct midi_capture_file_st *cfile, const void *data, size_t size) {
+	const uint8_t *src=data;
+	while (size>0) {
+		//Map next window
+		if (cfile->map==NULL || cfile->pos>=cfile->map_offset+MIDI_CAPTURE_FILE_CHUNK) {
+			if (cfile->map) munmap(cfile->map, MIDI_CAPTURE_FILE_CHUNK);
+			cfile->map_offset=cfile->pos-(cfile->pos % MIDI_CAPTURE_FILE_CHUNK);
+			if (ftruncate(cfile->fd, cfile->map_offset+MIDI_CAPTURE_FILE_CHUNK)) {
+				fprintf (stderr, "ZynMidiRouter: Can't grow MIDI capture file.\n");
+				cfile->map=NULL;
+				return 0;
+			}
+			cfile->map=mmap(NULL, MIDI_CAPTURE_FILE_CHUNK, PROT_READ|PROT_WRITE, MAP_SHARED, cfile->fd, cfile->map_offset);
+			if (cfile->map==MAP_FAILED) {
+				fprintf (stderr, "ZynMidiRouter: Can't map MIDI capture file.\n");
+				cfile->map=NULL;
+				return 0;
+			}
+		}
+		size_t offset=cfile->pos-cfile->map_offset;
+		size_t n=MIDI_CAPTURE_FILE_CHUNK-offset;
+		if (n>size) n=size;
+		memcpy(cfile->map+offset, src, n);
+		cfile->pos+=n;
+		src+=n;
+		size-=n;
+	}
+	return 1;
+}
+
+int midi_capture_file_open(struct midi_capture_file_st *cfile, char *fpath, int format, uint32_t sample_rate, uint32_t buffer_size, jack_nframes_t start_frame) {
+	cfile->fd=open(fpath, O_RDWR|O_CREAT|O_TRUNC, 0644);
+	if (cfile->fd<0) {
+		fprintf (stderr, "ZynMidiRouter: Can't open MIDI capture file '%s'.\n", fpath);
+		return 0;
+	}
+	cfile->format=format;
+	cfile->map=NULL;
+	cfile->map_offset=0;
+	cfile->pos=0;
+	cfile->sample_rate=sample_rate;
+	cfile->start_frame=start_frame;
+	cfile->last_tick=0;
+	cfile->last_port=-1;
+
+	if (format==MIDI_CAPTURE_FORMAT_SMF) {
+		uint8_t buffer[SMF_HEADER_SIZE+SMF_TRACK_HEADER_SIZE];
+		int n=smf_write_header(buffer, 0, 1, SMF_DIVISION_MS);
+		//Track length is set when closing the file
+		n+=smf_write_track_header(buffer+n, 0);
+		return midi_capture_file_write(cfile, buffer, n);
+	} else {
+		struct midi_capture_header_st header;
+		memset(&header, 0, sizeof(header));
+		strcpy(header.magic, MIDI_CAPTURE_MAGIC);
+		header.version=MIDI_CAPTURE_VERSION;
+		header.sample_rate=sample_rate;
+		header.buffer_size=buffer_size;
+		header.start_frame=start_frame;
+		return midi_capture_file_write(cfile, &header, sizeof(header));
+	}
+}
+
+int midi_capture_file_write_event(struct midi_capture_file_st *cfile, struct midi_capture_event_st *ev) {
+	if (cfile->format==MIDI_CAPTURE_FORMAT_SMF) {
+		uint8_t buffer[16];
+		int n=0;
+		uint32_t tick=(uint32_t)(((uint64_t)(uint32_t)(ev->frame-cfile->start_frame))*1000/cfile->sample_rate);
+		if (tick<cfile->last_tick) tick=cfile->last_tick;
+		//Port changes are recorded as "MIDI port" meta-events
+		if (ev->port!=cfile->last_port) {
+			n+=smf_write_vlq(buffer+n, tick-cfile->last_tick);
+			buffer[n++]=SMF_META;
+			buffer[n++]=SMF_META_PORT;
+			buffer[n++]=1;
+			buffer[n++]=ev->port;
+			cfile->last_port=ev->port;
+			cfile->last_tick=tick;
+		}
+		n+=smf_write_vlq(buffer+n, tick-cfile->last_tick);
+		memcpy(buffer+n, ev->data, ev->size);
+		n+=ev->size;
+		cfile->last_tick=tick;
+		return midi_capture_file_write(cfile, buffer, n);
+	} else {
+		return midi_capture_file_write(cfile, ev, sizeof(struct midi_capture_event_st));
+	}
+}
+
+int midi_capture_file_close(struct midi_capture_file_st *cfile) {
+	if (cfile->format==MIDI_CAPTURE_FORMAT_SMF) {
+		uint8_t buffer[4]={ 0, SMF_META, SMF_META_END_OF_TRACK, 0 };
+		midi_capture_file_write(cfile, buffer, 4);
+	}
+	if (cfile->map) munmap(cfile->map, MIDI_CAPTURE_FILE_CHUNK);
+	cfile->map=NULL;
+	//Truncate to real size
+	if (ftruncate(cfile->fd, cfile->pos)) {
+		fprintf (stderr, "ZynMidiRouter: Can't truncate MIDI capture file.\n");
+	}
+	//Set SMF track length
+	if (cfile->format==MIDI_CAPTURE_FORMAT_SMF) {
+		uint8_t buffer[SMF_TRACK_HEADER_SIZE];
+		smf_write_track_header(buffer, cfile->pos-SMF_HEADER_SIZE-SMF_TRACK_HEADER_SIZE);
+		if (pwrite(cfile->fd, buffer, SMF_TRACK_HEADER_SIZE, SMF_HEADER_SIZE)!=SMF_TRACK_HEADER_SIZE) {
+			fprintf (stderr, "ZynMidiRouter: Can't write SMF track length.\n");
+		}
+	}
+	close(cfile->fd);
+	return 1;
+}
+
+//-----------------------------------------------------------------------------
+// Capture Control
+//-----------------------------------------------------------------------------
+
+jack_ringbuffer_t *midi_capture_ring;
+struct midi_capture_file_st midi_capture_file;
+pthread_t midi_capture_tid;
+volatile int midi_capture_running;
+volatile uint32_t midi_capture_dropped;
+
+int init_midi_capture() {
+	midi_capture_zmips=0;
+	midi_capture_zmops=0;
+	midi_capture_running=0;
+	midi_capture_dropped=0;
+	midi_capture_ring=jack_ringbuffer_create(MIDI_CAPTURE_RING_SIZE);
+	// lock the buffer into memory, this is *NOT* realtime safe, do it before using the buffer!
+	if (jack_ringbuffer_mlock(midi_capture_ring)) {
+		fprintf (stderr, "ZynMidiRouter: Error locking memory for MIDI capture ring-buffer.\n");
+		return 0;
+	}
+	return 1;
+}
+
+int end_midi_capture() {
+	stop_midi_capture();
+	jack_ringbuffer_free(midi_capture_ring);
+	midi_capture_ring=NULL;
+	return 1;
+}
+
+void * midi_capture_thread(void *arg) {
+	struct midi_capture_event_st ev;
+	while (1) {
+		int running=midi_capture_running;
+		while (jack_ringbuffer_read_space(midi_capture_ring)>=sizeof(ev)) {
+			jack_ringbuffer_read(midi_capture_ring, (char *)&ev, sizeof(ev));
+			midi_capture_file_write_event(&midi_capture_file, &ev);
+		}
+		if (!running) break;
+		usleep(MIDI_CAPTURE_POLL_US);
+	}
+	midi_capture_file_close(&midi_capture_file);
+	return NULL;
+}
+
+int start_midi_capture(char *fpath, int format, uint32_t zmips_mask, uint32_t zmops_mask) {
+	if (midi_capture_running) {
+		fprintf (stderr, "ZynMidiRouter: MIDI capture is already running.\n");
+		return 0;
+	}
+	if (format!=MIDI_CAPTURE_FORMAT_LOG && format!=MIDI_CAPTURE_FORMAT_SMF) {
+		fprintf (stderr, "ZynMidiRouter: MIDI capture format (%d) is not valid!\n", format);
+		return 0;
+	}
+	//Start on a cycle boundary, so replayed captures keep the same event alignment
+	uint32_t sample_rate=jack_sample_rate ? jack_sample_rate : 48000;
+	if (!midi_capture_file_open(&midi_capture_file, fpath, format, sample_rate, jack_buffer_size, jack_cycle_frame)) return 0;
+
+	//Discard events left from last capture
+	jack_ringbuffer_read_advance(midi_capture_ring, jack_ringbuffer_read_space(midi_capture_ring));
+	midi_capture_dropped=0;
+
+	midi_capture_running=1;
+	int err=pthread_create(&midi_capture_tid, NULL, &midi_capture_thread, NULL);
+	if (err != 0) {
+		fprintf (stderr, "ZynMidiRouter: Can't create MIDI capture thread :[%s]\n", strerror(err));
+		midi_capture_running=0;
+		midi_capture_file_close(&midi_capture_file);
+		return 0;
+	}
+
+	//Enable RT capture
+	midi_capture_zmips=zmips_mask & ((1<<MAX_NUM_ZMIPS)-1);
+	midi_capture_zmops=zmops_mask & ((1<<MAX_NUM_ZMOPS)-1);
+	return 1;
+}
+
+int stop_midi_capture() {
+	if (!midi_capture_running) return 0;
+	//Disable RT capture
+	midi_capture_zmips=0;
+	midi_capture_zmops=0;
+	//Drain ring-buffer & close file
+	midi_capture_running=0;
+	pthread_join(midi_capture_tid, NULL);
+	if (midi_capture_dropped>0) {
+		fprintf (stderr, "ZynMidiRouter: MIDI capture dropped %d events.\n", midi_capture_dropped);
+	}
+	return 1;
+}
+
+int set_midi_capture_zmips(uint32_t mask) {
+	if (!midi_capture_running) return 0;
+	midi_capture_zmips=mask & ((1<<MAX_NUM_ZMIPS)-1);
+	return 1;
+}
+
+int set_midi_capture_zmops(uint32_t mask) {
+	if (!midi_capture_running) return 0;
+	midi_capture_zmops=mask & ((1<<MAX_NUM_ZMOPS)-1);
+	return 1;
+}
+
+int is_midi_capture_running() {
+	return midi_capture_running;
+}
+
+uint32_t get_midi_capture_dropped() {
+	return midi_capture_dropped;
+}
+
+size_t get_midi_capture_pending() {
+	return jack_ringbuffer_read_space(midi_capture_ring);
+}
+
+//-----------------------------------------------------------------------------
+// RT capture
+//-----------------------------------------------------------------------------
+
+void capture_midi_event(uint8_t port, jack_nframes_t frame, uint8_t *data, int size) {
+	struct midi_capture_event_st ev;
+	if (size<1 || size>3) return;
+	if (jack_ringbuffer_write_space(midi_capture_ring)<sizeof(ev)) {
+		midi_capture_dropped++;
+		return;
+	}
+	ev.frame=frame;
+	ev.port=port;
+	ev.size=size;
+	memcpy(ev.data, data, size);
+	memset(ev.data+size, 0, 3-size);
+	memset(ev.reserved, 0, 3);
+	jack_ringbuffer_write(midi_capture_ring, (char *)&ev, sizeof(ev));
+}
+
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Log Reading
+//-----------------------------------------------------------------------------
+
+struct midi_capture_event_st *load_midi_capture(const char *fpath, struct midi_capture_header_st *header, int *n_events) {
+	FILE *fp=fopen(fpath, "rb");
+	if (!fp) {
+		fprintf (stderr, "ZynMidiRouter: Can't open MIDI capture file '%s'.\n", fpath);
+		return NULL;
+	}
+	if (fread(header, sizeof(struct midi_capture_header_st), 1, fp)!=1 || memcmp(header->magic, MIDI_CAPTURE_MAGIC, 8)!=0) {
+		fprintf (stderr, "ZynMidiRouter: Bad MIDI capture file '%s'.\n", fpath);
+		fclose(fp);
+		return NULL;
+	}
+	if (header->version!=MIDI_CAPTURE_VERSION) {
+		fprintf (stderr, "ZynMidiRouter: MIDI capture file version (%d) is not supported.\n", header->version);
+		fclose(fp);
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	long n=(ftell(fp)-(long)sizeof(struct midi_capture_header_st))/sizeof(struct midi_capture_event_st);
+	fseek(fp, sizeof(struct midi_capture_header_st), SEEK_SET);
+	struct midi_capture_event_st *events=malloc((n>0 ? n : 1)*sizeof(struct midi_capture_event_st));
+	*n_events=fread(events, sizeof(struct midi_capture_event_st), n, fp);
+	fclose(fp);
+	return events;
+}
+
+//-----------------------------------------------------------------------------
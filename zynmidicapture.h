@@ -0,0 +1,94 @@
+/*
+ * ******************************************************************
+ * ZYNTHIAN PROJECT: ZynMidiRouter Library
+ * 
+ * MIDI capture: Records the events passing through the router ports
+ * 
+ * Copyright (C) 2015-2018 Fernando Moyano <jofemodo@zynthian.org>
+ *
+ * ******************************************************************
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * For a full copy of the GNU General Public License see the LICENSE.txt file.
+ * 
+ * ******************************************************************
+ */
+
+#include <stdint.h>
+#include <jack/jack.h>
+#include <jack/ringbuffer.h>
+
+//-----------------------------------------------------------------------------
+// MIDI Capture
+//-----------------------------------------------------------------------------
+//	+ The RT thread copies the events from the tapped zmips/zmops to a
+//	  lock-free ring-buffer. If the ring is full, events are dropped & counted.
+//	+ A writer thread streams the events to a memory-mapped, append-only file,
+//	  mapping a window of MIDI_CAPTURE_FILE_CHUNK bytes at a time.
+//	+ Capture is enabled/disabled by setting/clearing the port masks.
+//-----------------------------------------------------------------------------
+
+#define MIDI_CAPTURE_FORMAT_LOG 0
+#define MIDI_CAPTURE_FORMAT_SMF 1
+
+#define MIDI_CAPTURE_RING_SIZE (64*1024)
+#define MIDI_CAPTURE_FILE_CHUNK (1024*1024)
+#define MIDI_CAPTURE_POLL_US 10000
+
+//Port index flag for output ports (zmops)
+#define MIDI_CAPTURE_ZMOP 0x80
+
+#define MIDI_CAPTURE_MAGIC "ZYNMCAP"
+#define MIDI_CAPTURE_VERSION 1
+
+//Log file header
+struct midi_capture_header_st {
+	char magic[8];
+	uint32_t version;
+	uint32_t sample_rate;
+	uint32_t buffer_size;
+	uint32_t start_frame;
+};
+
+//Log file record
+struct midi_capture_event_st {
+	uint32_t frame;
+	uint8_t port;
+	uint8_t size;
+	uint8_t data[3];
+	uint8_t reserved[3];
+};
+
+//Port masks => bit N is zmip/zmop N
+volatile uint32_t midi_capture_zmips;
+volatile uint32_t midi_capture_zmops;
+
+int init_midi_capture();
+int end_midi_capture();
+
+int start_midi_capture(char *fpath, int format, uint32_t zmips_mask, uint32_t zmops_mask);
+int stop_midi_capture();
+int set_midi_capture_zmips(uint32_t mask);
+int set_midi_capture_zmops(uint32_t mask);
+int is_midi_capture_running();
+uint32_t get_midi_capture_dropped();
+
+//RT capture function
+void capture_midi_event(uint8_t port, jack_nframes_t frame, uint8_t *data, int size);
+
+//Bytes waiting in the ring-buffer to be written
+size_t get_midi_capture_pending();
+
+//Load a log file => Return malloc'ed array of events (NULL if error)
+struct midi_capture_event_st *load_midi_capture(const char *fpath, struct midi_capture_header_st *header, int *n_events);
+
+//-----------------------------------------------------------------------------
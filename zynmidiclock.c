@@ -0,0 +1,332 @@
+/*
+ * ******************************************************************
+ * ZYNTHIAN PROJECT: ZynMidiRouter Library
+ *
+ * MIDI Clock: Tempo estimation from incoming clock & internal clock generator
+ *
+ * Copyright (C) 2015-2018 Fernando Moyano <jofemodo@zynthian.org>
+ *
+ * ******************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * For a full copy of the GNU General Public License see the LICENSE.txt file.
+ *
+ * ******************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "zynmidirouter.h"
+#include "zynmidiclock.h"
+
+//-----------------------------------------------------------------------------
+// Estimator => RT thread only
+//-----------------------------------------------------------------------------
+
+struct midi_clock_est_st {
+	//Configured source (-1 => any) & followed zmip (-1 => none)
+	int source;
+	int zmip;
+	//Frame times of the last ticks => ring buffer
+	uint32_t ticks[MIDI_CLOCK_WINDOW];
+	int n_ticks;
+	int i_tick;
+	uint32_t last_frame;
+	//Working copy of the published state
+	struct midi_clock_state_st state;
+};
+struct midi_clock_est_st midi_clock_est;
+
+//Published state => seq is odd while updating
+struct midi_clock_pub_st {
+	volatile uint32_t seq;
+	struct midi_clock_state_st state;
+};
+struct midi_clock_pub_st midi_clock_pub;
+
+void publish_midi_clock() {
+	midi_clock_pub.seq++;
+	__sync_synchronize();
+	midi_clock_pub.state=midi_clock_est.state;
+	__sync_synchronize();
+	midi_clock_pub.seq++;
+}
+
+int init_midi_clock() {
+	memset(&midi_clock_est, 0, sizeof(midi_clock_est));
+	midi_clock_est.source=-1;
+	midi_clock_est.zmip=-1;
+	midi_clock_est.state.zmip=-1;
+	publish_midi_clock();
+	return 1;
+}
+
+void set_midi_clock_source(int iz) {
+	if (iz<-1 || iz>=MAX_NUM_ZMIPS) {
+		fprintf (stderr, "ZynMidiRouter: Bad MIDI clock source (%d).\n", iz);
+		return;
+	}
+	//Next tick will restart the estimation
+	midi_clock_est.source=iz;
+}
+
+int get_midi_clock_source() {
+	return midi_clock_est.source;
+}
+
+//Least-squares fit of tick frame times over the window => frame = a + b * tick
+void fit_midi_clock() {
+	struct midi_clock_est_st *est=&midi_clock_est;
+	struct midi_clock_state_st *state=&est->state;
+	int n=est->n_ticks;
+	int i0=(est->i_tick-n+MIDI_CLOCK_WINDOW) % MIDI_CLOCK_WINDOW;
+	uint32_t t0=est->ticks[i0];
+	double sx=0.5*n*(n-1);
+	double sxx=(double)(n-1)*n*(2*n-1)/6.0;
+	double sy=0, sxy=0;
+	int k;
+	for (k=0;k<n;k++) {
+		double y=(uint32_t)(est->ticks[(i0+k) % MIDI_CLOCK_WINDOW]-t0);
+		sy+=y;
+		sxy+=k*y;
+	}
+	double b=(n*sxy-sx*sy)/(n*sxx-sx*sx);
+	double a=(sy-b*sx)/n;
+	double res=0;
+	for (k=0;k<n;k++) {
+		double e=(uint32_t)(est->ticks[(i0+k) % MIDI_CLOCK_WINDOW]-t0)-(a+b*k);
+		res+=e*e;
+	}
+	if (b<=0) return;
+	state->frames_per_tick=b;
+	state->bpm=60.0*jack_sample_rate/(MIDI_CLOCK_PPQN*b);
+	state->jitter=sqrt(res/n);
+	state->tick_frame=t0+(uint32_t)lround(a+b*(n-1));
+	state->locked=(n>=MIDI_CLOCK_MIN_TICKS && state->jitter<MIDI_CLOCK_LOCK_JITTER*b);
+}
+
+void midi_clock_tick(int iz, uint32_t frame) {
+	struct midi_clock_est_st *est=&midi_clock_est;
+	struct midi_clock_state_st *state=&est->state;
+	if (est->source>=0 && iz!=est->source) return;
+	uint32_t gap=(uint32_t)(MIDI_CLOCK_GAP_SECONDS*jack_sample_rate);
+	if (est->zmip!=iz) {
+		//Other zmip => take over only if the followed one is silent
+		if (est->zmip>=0 && est->source<0 && (uint32_t)(frame-est->last_frame)<gap) return;
+		est->zmip=iz;
+		est->n_ticks=0;
+	}
+	//Clock gap => restart the estimation
+	else if (est->n_ticks>0) {
+		if (state->locked) gap=(uint32_t)(MIDI_CLOCK_GAP_TICKS*state->frames_per_tick);
+		if ((uint32_t)(frame-est->last_frame)>gap) est->n_ticks=0;
+	}
+	if (est->n_ticks==0) {
+		state->locked=0;
+		state->jitter=0;
+	}
+	est->last_frame=frame;
+	est->ticks[est->i_tick]=frame;
+	est->i_tick=(est->i_tick+1) % MIDI_CLOCK_WINDOW;
+	if (est->n_ticks<MIDI_CLOCK_WINDOW) est->n_ticks++;
+	state->zmip=iz;
+	state->tick_count++;
+	if (est->n_ticks>=2) fit_midi_clock();
+	else state->tick_frame=frame;
+	publish_midi_clock();
+}
+
+void midi_clock_transport(int iz, uint8_t status, uint32_t frame) {
+	struct midi_clock_est_st *est=&midi_clock_est;
+	struct midi_clock_state_st *state=&est->state;
+	if (est->source>=0 && iz!=est->source) return;
+	if (est->source<0 && est->zmip>=0 && iz!=est->zmip) return;
+	switch (status) {
+		//First tick after start is the beat's first tick
+		case TRANSPORT_START:
+			state->tick_count=0;
+			state->running=1;
+			break;
+		case TRANSPORT_CONTINUE:
+			state->running=1;
+			break;
+		case TRANSPORT_STOP:
+			state->running=0;
+			break;
+		default:
+			return;
+	}
+	publish_midi_clock();
+}
+
+//-----------------------------------------------------------------------------
+// Query API
+//-----------------------------------------------------------------------------
+
+int get_midi_clock_state(struct midi_clock_state_st *state) {
+	int retries;
+	for (retries=0;retries<1000;retries++) {
+		uint32_t seq=midi_clock_pub.seq;
+		if (seq & 1) {
+			usleep(10);
+			continue;
+		}
+		__sync_synchronize();
+		memcpy(state, &midi_clock_pub.state, sizeof(struct midi_clock_state_st));
+		__sync_synchronize();
+		if (midi_clock_pub.seq==seq) return 1;
+	}
+	return 0;
+}
+
+double get_midi_clock_bpm() {
+	struct midi_clock_state_st state;
+	if (!get_midi_clock_state(&state) || !state.locked) return 0;
+	return state.bpm;
+}
+
+int get_midi_clock_locked() {
+	struct midi_clock_state_st state;
+	if (!get_midi_clock_state(&state)) return 0;
+	return state.locked;
+}
+
+double get_midi_clock_phase(uint32_t frame) {
+	struct midi_clock_state_st state;
+	if (!get_midi_clock_state(&state) || !state.locked || state.tick_count==0) return -1;
+	//Position of the last tick, plus the fraction of tick since it (signed, frame may be earlier)
+	double pos=(state.tick_count-1)+(int32_t)(frame-state.tick_frame)/state.frames_per_tick;
+	double phase=fmod(pos, MIDI_CLOCK_PPQN)/MIDI_CLOCK_PPQN;
+	if (phase<0) phase+=1.0;
+	return phase;
+}
+
+//-----------------------------------------------------------------------------
+// Clock Generator
+//-----------------------------------------------------------------------------
+
+struct midi_clock_gen_st {
+	//Requests => applied by the RT thread
+	volatile double bpm;
+	volatile uint8_t enabled;
+	volatile uint8_t transport;
+	volatile uint32_t zmops;
+	//RT state => next tick offset from the cycle start & tick length, in 32.32 fixed point
+	int64_t next_tick;
+	int64_t tick_frames;
+	double tick_bpm;
+	uint8_t running;
+	uint32_t tick_count;
+};
+struct midi_clock_gen_st midi_clock_gen={ .bpm=120.0, .zmops=1<<ZMOP_MIDI };
+
+int set_midi_clock_gen_bpm(double bpm) {
+	if (bpm<MIDI_CLOCK_GEN_MIN_BPM || bpm>MIDI_CLOCK_GEN_MAX_BPM) {
+		fprintf (stderr, "ZynMidiRouter: MIDI clock tempo (%f) is out of range!\n", bpm);
+		return 0;
+	}
+	midi_clock_gen.bpm=bpm;
+	return 1;
+}
+
+double get_midi_clock_gen_bpm() {
+	return midi_clock_gen.bpm;
+}
+
+int set_midi_clock_gen_zmops(uint32_t zmop_mask) {
+	if (zmop_mask>>MAX_NUM_ZMOPS) {
+		fprintf (stderr, "ZynMidiRouter: Bad MIDI clock output ports (%x).\n", zmop_mask);
+		return 0;
+	}
+	midi_clock_gen.zmops=zmop_mask;
+	return 1;
+}
+
+void set_midi_clock_gen_enabled(int enabled) {
+	midi_clock_gen.enabled=enabled ? 1 : 0;
+}
+
+int set_midi_clock_gen_transport(uint8_t status) {
+	if (status!=TRANSPORT_START && status!=TRANSPORT_STOP && status!=TRANSPORT_CONTINUE) {
+		fprintf (stderr, "ZynMidiRouter: Bad MIDI transport message (%x).\n", status);
+		return 0;
+	}
+	if (status==TRANSPORT_START) midi_clock_gen.enabled=1;
+	midi_clock_gen.transport=status;
+	return 1;
+}
+
+void get_midi_clock_gen_state(struct midi_clock_gen_state_st *state) {
+	state->bpm=midi_clock_gen.bpm;
+	state->enabled=midi_clock_gen.enabled;
+	state->running=midi_clock_gen.running;
+	state->zmops=midi_clock_gen.zmops;
+	state->tick_count=midi_clock_gen.tick_count;
+}
+
+//Push a realtime event to the selected zmops
+void push_midi_clock_event(uint32_t zmop_mask, uint32_t frame, uint8_t status) {
+	int ie=midi_arena_add(frame, &status, 1);
+	if (ie<0) return;
+	uint8_t rt_bit=(status==TIME_CLOCK) ? MIDI_RT_CLOCK : MIDI_RT_TRANSPORT;
+	int i;
+	for (i=0;i<MAX_NUM_ZMOPS;i++) {
+		if ((zmop_mask & (1<<i)) && zmops[i].n_connections>0 && (zmops[i].rt_mask & rt_bit)) zmop_push_rt_index(i, ie);
+	}
+}
+
+void generate_midi_clock(uint32_t nframes) {
+	struct midi_clock_gen_st *gen=&midi_clock_gen;
+	uint32_t zmop_mask=gen->zmops;
+
+	//Tempo => applied from this cycle
+	double bpm=gen->bpm;
+	if (bpm!=gen->tick_bpm) {
+		gen->tick_bpm=bpm;
+		gen->tick_frames=(int64_t)llround(60.0*jack_sample_rate/(MIDI_CLOCK_PPQN*bpm)*4294967296.0);
+	}
+
+	//Transport => at the cycle's first frame. Start restarts the tick grid.
+	uint8_t transport=gen->transport;
+	if (transport) {
+		gen->transport=0;
+		if (transport==TRANSPORT_START) {
+			gen->tick_count=0;
+			gen->next_tick=0;
+		}
+		gen->running=(transport!=TRANSPORT_STOP);
+		push_midi_clock_event(zmop_mask, 0, transport);
+	}
+
+	if (!gen->enabled) {
+		gen->next_tick=0;
+		return;
+	}
+
+	//Ticks in this cycle => rounded to the nearest frame
+	int64_t cycle_frames=(int64_t)nframes << 32;
+	while (gen->next_tick<cycle_frames) {
+		uint32_t frame=(uint32_t)((gen->next_tick+0x80000000LL) >> 32);
+		if (frame>=nframes) frame=nframes-1;
+		push_midi_clock_event(zmop_mask, frame, TIME_CLOCK);
+		gen->tick_count++;
+		gen->next_tick+=gen->tick_frames;
+	}
+	gen->next_tick-=cycle_frames;
+}
+
+//-----------------------------------------------------------------------------
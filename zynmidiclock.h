@@ -0,0 +1,124 @@
+/*
+ * ******************************************************************
+ * ZYNTHIAN PROJECT: ZynMidiRouter Library
+ *
+ * MIDI Clock: Tempo estimation from incoming clock & internal clock generator
+ *
+ * Copyright (C) 2015-2018 Fernando Moyano <jofemodo@zynthian.org>
+ *
+ * ******************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * For a full copy of the GNU General Public License see the LICENSE.txt file.
+ *
+ * ******************************************************************
+ */
+
+#include <stdint.h>
+
+//-----------------------------------------------------------------------------
+// MIDI Clock Tempo Estimator
+//-----------------------------------------------------------------------------
+//	+ The RT thread feeds the frame time of every TIME_CLOCK event received
+//	  by a zmip. A least-squares line is fitted over a sliding window of the
+//	  last ticks, so the tempo & tick phase are free of the jitter of each
+//	  single tick.
+//	+ Clock is followed from one zmip at a time. With source -1 (any), the
+//	  first zmip sending clock is used, until it stops for a while.
+//	+ The estimation is "locked" when the window has enough ticks and the
+//	  residual jitter is small. A gap in the clock resets the window.
+//	+ The published state is protected by a seqlock, so it can be queried
+//	  from any thread without locks.
+//-----------------------------------------------------------------------------
+
+#define MIDI_CLOCK_PPQN 24
+//Fit window => 2 beats
+#define MIDI_CLOCK_WINDOW 48
+//Minimum ticks for lock
+#define MIDI_CLOCK_MIN_TICKS 12
+//Max residual jitter for lock => fraction of a tick
+#define MIDI_CLOCK_LOCK_JITTER 0.1
+//Clock gap resetting the window => in ticks (locked) or seconds (not locked)
+#define MIDI_CLOCK_GAP_TICKS 4
+#define MIDI_CLOCK_GAP_SECONDS 0.5
+
+struct midi_clock_state_st {
+	//Source zmip (-1 => none)
+	int zmip;
+	uint8_t locked;
+	//Transport => started & not stopped
+	uint8_t running;
+	double bpm;
+	double frames_per_tick;
+	//RMS residual of the fit, in frames
+	double jitter;
+	//Fitted frame time of the last tick & ticks since transport start
+	uint32_t tick_frame;
+	uint32_t tick_count;
+};
+
+int init_midi_clock();
+
+//Clock source => zmip index or -1 for any
+void set_midi_clock_source(int iz);
+int get_midi_clock_source();
+
+//RT functions => Called from the realtime lane
+void midi_clock_tick(int iz, uint32_t frame);
+void midi_clock_transport(int iz, uint8_t status, uint32_t frame);
+
+//Query API => lock-free, from any thread. Return 0 if the state is busy.
+int get_midi_clock_state(struct midi_clock_state_st *state);
+//Tempo in BPM => 0 if not locked
+double get_midi_clock_bpm();
+int get_midi_clock_locked();
+//Beat phase [0, 1) at the given frame => -1 if not locked
+double get_midi_clock_phase(uint32_t frame);
+
+//-----------------------------------------------------------------------------
+// MIDI Clock Generator
+//-----------------------------------------------------------------------------
+//	+ Clock ticks are placed with 32.32 fixed-point frame offsets, carried
+//	  from cycle to cycle, so the clock doesn't drift at any tempo.
+//	+ Tempo & transport requests are applied at the start of next cycle.
+//	  Transport messages go at the cycle's first frame, before its ticks.
+//	+ Events are pushed to the realtime lane of the selected zmops.
+//-----------------------------------------------------------------------------
+
+#define MIDI_CLOCK_GEN_MIN_BPM 10.0
+#define MIDI_CLOCK_GEN_MAX_BPM 400.0
+
+struct midi_clock_gen_state_st {
+	double bpm;
+	//Clock ticks are being sent
+	uint8_t enabled;
+	//Transport => started & not stopped
+	uint8_t running;
+	//Destination zmops => bitmask
+	uint32_t zmops;
+	//Ticks since transport start
+	uint32_t tick_count;
+};
+
+//Return 0 if error
+int set_midi_clock_gen_bpm(double bpm);
+double get_midi_clock_gen_bpm();
+int set_midi_clock_gen_zmops(uint32_t zmop_mask);
+void set_midi_clock_gen_enabled(int enabled);
+//Request transport => TRANSPORT_START (also enables the clock), TRANSPORT_STOP or TRANSPORT_CONTINUE
+int set_midi_clock_gen_transport(uint8_t status);
+void get_midi_clock_gen_state(struct midi_clock_gen_state_st *state);
+
+//RT function => Called at the start of the jack process cycle
+void generate_midi_clock(uint32_t nframes);
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,320 @@
+/*
+ * ******************************************************************
+ * ZYNTHIAN PROJECT: ZynMidiRouter Library
+ *
+ * MIDI Player: Streaming SMF player feeding the sequencer input port
+ *
+ * Copyright (C) 2015-2018 Fernando Moyano <jofemodo@zynthian.org>
+ *
+ * ******************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * For a full copy of the GNU General Public License see the LICENSE.txt file.
+ *
+ * ******************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <jack/jack.h>
+#include <jack/ringbuffer.h>
+
+#include "zynmidirouter.h"
+#include "zynmidiplayer.h"
+#include "zynsmf.h"
+
+//-----------------------------------------------------------------------------
+// Player State
+//-----------------------------------------------------------------------------
+
+struct smf_st *midi_player_smf=NULL;
+uint64_t midi_player_length=0;
+jack_ringbuffer_t *midi_player_ring;
+pthread_t midi_player_tid;
+volatile int midi_player_loaded=0;
+
+//Requests => seek frame is written before bumping the generation
+volatile uint32_t midi_player_gen=0;
+volatile uint64_t midi_player_seek_frame=0;
+volatile int midi_player_playing=0;
+volatile int midi_player_loop=0;
+//Set by RT thread
+volatile int midi_player_ended=0;
+volatile uint32_t midi_player_position=0;
+
+//RT state
+struct midi_player_rt_st {
+	uint32_t gen;
+	//Events from the current generation have arrived
+	int primed;
+	int playing;
+	//Stream frame at cycle start & at last loop
+	uint64_t pos;
+	uint64_t loop_frame;
+	uint8_t notes[16][128];
+};
+struct midi_player_rt_st midi_player_rt;
+
+int init_midi_player() {
+	memset(&midi_player_rt, 0, sizeof(midi_player_rt));
+	midi_player_ring=jack_ringbuffer_create(MIDI_PLAYER_RING_SIZE);
+	// lock the buffer into memory, this is *NOT* realtime safe, do it before using the buffer!
+	if (jack_ringbuffer_mlock(midi_player_ring)) {
+		fprintf (stderr, "ZynMidiRouter: Error locking memory for MIDI player ring-buffer.\n");
+		return 0;
+	}
+	return 1;
+}
+
+int end_midi_player() {
+	unload_midi_player();
+	jack_ringbuffer_free(midi_player_ring);
+	midi_player_ring=NULL;
+	return 1;
+}
+
+//-----------------------------------------------------------------------------
+// Loader Thread
+//-----------------------------------------------------------------------------
+
+void * midi_player_thread(void *arg) {
+	struct smf_st *smf=midi_player_smf;
+	struct smf_event_st ev;
+	struct midi_player_event_st rec;
+	uint64_t sample_rate=jack_sample_rate;
+	uint32_t gen=0;
+	uint64_t seek_frame=0;
+	uint64_t base=0;
+	int started=0;
+	int eof=0;
+	while (midi_player_loaded) {
+		//Load or seek => restart streaming from the requested position
+		uint32_t cur_gen=midi_player_gen;
+		__sync_synchronize();
+		if (!started || cur_gen!=gen) {
+			gen=cur_gen;
+			seek_frame=midi_player_seek_frame;
+			base=0;
+			eof=0;
+			started=1;
+			smf_rewind(smf);
+		}
+		while (!eof && gen==midi_player_gen && jack_ringbuffer_write_space(midi_player_ring)>=sizeof(rec)) {
+			memset(&rec, 0, sizeof(rec));
+			rec.gen=gen;
+			if (smf_next_event(smf, &ev)==0) {
+				uint64_t frame=ev.time_us*sample_rate/1000000;
+				//Events before the seek position are skipped in the first pass
+				if (base==0 && frame<seek_frame) continue;
+				rec.type=MIDI_PLAYER_EVENT;
+				rec.frame=base+frame;
+				rec.size=ev.size;
+				memcpy(rec.data, ev.data, ev.size);
+			}
+			else if (midi_player_loop && midi_player_length>0) {
+				base+=midi_player_length;
+				rec.type=MIDI_PLAYER_LOOP;
+				rec.frame=base;
+				smf_rewind(smf);
+			}
+			else {
+				rec.type=MIDI_PLAYER_END;
+				rec.frame=base+midi_player_length;
+				eof=1;
+			}
+			jack_ringbuffer_write(midi_player_ring, (char *)&rec, sizeof(rec));
+		}
+		usleep(MIDI_PLAYER_POLL_US);
+	}
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Player Control
+//-----------------------------------------------------------------------------
+
+//Restart streaming from frame => drops events in the ring-buffer
+void midi_player_seek(uint64_t frame) {
+	if (frame>midi_player_length) frame=midi_player_length;
+	midi_player_seek_frame=frame;
+	midi_player_ended=0;
+	__sync_synchronize();
+	midi_player_gen++;
+}
+
+int load_midi_player(char *fpath) {
+	unload_midi_player();
+	struct smf_st *smf=smf_open(fpath);
+	if (!smf) return 0;
+	midi_player_length=smf_get_length_us(smf)*jack_sample_rate/1000000;
+	midi_player_smf=smf;
+	midi_player_playing=0;
+	midi_player_seek(0);
+
+	midi_player_loaded=1;
+	int err=pthread_create(&midi_player_tid, NULL, &midi_player_thread, NULL);
+	if (err != 0) {
+		fprintf (stderr, "ZynMidiRouter: Can't create MIDI player thread :[%s]\n", strerror(err));
+		midi_player_loaded=0;
+		midi_player_smf=NULL;
+		smf_close(smf);
+		return 0;
+	}
+	return 1;
+}
+
+int unload_midi_player() {
+	if (!midi_player_smf) return 0;
+	midi_player_playing=0;
+	midi_player_loaded=0;
+	pthread_join(midi_player_tid, NULL);
+	smf_close(midi_player_smf);
+	midi_player_smf=NULL;
+	midi_player_length=0;
+	//Drop streamed events
+	midi_player_seek(0);
+	return 1;
+}
+
+int start_midi_player() {
+	if (!midi_player_smf) {
+		fprintf (stderr, "ZynMidiRouter: No MIDI player file loaded.\n");
+		return 0;
+	}
+	//Song ended => play again from the beginning
+	if (midi_player_ended) midi_player_seek(0);
+	midi_player_playing=1;
+	return 1;
+}
+
+int stop_midi_player() {
+	if (!midi_player_playing) return 0;
+	midi_player_playing=0;
+	return 1;
+}
+
+int is_midi_player_running() {
+	return midi_player_playing;
+}
+
+int seek_midi_player(uint32_t ms) {
+	if (!midi_player_smf) {
+		fprintf (stderr, "ZynMidiRouter: No MIDI player file loaded.\n");
+		return 0;
+	}
+	midi_player_seek((uint64_t)ms*jack_sample_rate/1000);
+	return 1;
+}
+
+uint32_t get_midi_player_position() {
+	return (uint64_t)midi_player_position*1000/jack_sample_rate;
+}
+
+uint32_t get_midi_player_length() {
+	return midi_player_length*1000/jack_sample_rate;
+}
+
+void set_midi_player_loop(int loop) {
+	midi_player_loop=loop ? 1 : 0;
+}
+
+int get_midi_player_loop() {
+	return midi_player_loop;
+}
+
+//-----------------------------------------------------------------------------
+// RT injection
+//-----------------------------------------------------------------------------
+
+void midi_player_notes_off(jack_nframes_t offset) {
+	int chan, note;
+	for (chan=0;chan<16;chan++) {
+		for (note=0;note<128;note++) {
+			if (!midi_player_rt.notes[chan][note]) continue;
+			uint8_t data[3]={ (NOTE_OFF<<4) | chan, note, 0 };
+			zmip_inject_event(MIDI_PLAYER_ZMIP, offset, data, 3);
+			midi_player_rt.notes[chan][note]=0;
+		}
+	}
+}
+
+void inject_midi_player_events(jack_nframes_t nframes) {
+	struct midi_player_rt_st *rt=&midi_player_rt;
+	struct midi_player_event_st rec;
+
+	//Load or seek => restart from the requested position
+	uint32_t gen=midi_player_gen;
+	__sync_synchronize();
+	if (gen!=rt->gen) {
+		midi_player_notes_off(0);
+		rt->gen=gen;
+		rt->pos=midi_player_seek_frame;
+		rt->loop_frame=0;
+		rt->primed=0;
+		midi_player_position=rt->pos;
+	}
+
+	//Drop events from older generations, so the loader can refill the ring-buffer
+	while (jack_ringbuffer_peek(midi_player_ring, (char *)&rec, sizeof(rec))==sizeof(rec)) {
+		if ((int32_t)(rec.gen-rt->gen)>=0) break;
+		jack_ringbuffer_read_advance(midi_player_ring, sizeof(rec));
+	}
+
+	if (!midi_player_playing) {
+		if (rt->playing) midi_player_notes_off(0);
+		rt->playing=0;
+		return;
+	}
+	rt->playing=1;
+
+	uint64_t end=rt->pos+nframes;
+	while (jack_ringbuffer_peek(midi_player_ring, (char *)&rec, sizeof(rec))==sizeof(rec)) {
+		if (rec.gen!=rt->gen) break;
+		rt->primed=1;
+		if (rec.frame>=end) break;
+		jack_nframes_t offset=(rec.frame>rt->pos) ? rec.frame-rt->pos : 0;
+		if (rec.type==MIDI_PLAYER_EVENT) {
+			//Injection buffer is full => retry next cycle
+			if (!zmip_inject_event(MIDI_PLAYER_ZMIP, offset, rec.data, rec.size)) break;
+			uint8_t event_type=rec.data[0] >> 4;
+			if (event_type==NOTE_ON || event_type==NOTE_OFF) {
+				rt->notes[rec.data[0] & 0x0F][rec.data[1]]=(event_type==NOTE_ON && rec.data[2]>0);
+			}
+		}
+		else {
+			midi_player_notes_off(offset);
+			if (rec.type==MIDI_PLAYER_LOOP) rt->loop_frame=rec.frame;
+			else {
+				//Song end => stop at the end position
+				jack_ringbuffer_read_advance(midi_player_ring, sizeof(rec));
+				rt->pos=rec.frame;
+				rt->playing=0;
+				midi_player_position=rt->pos-rt->loop_frame;
+				midi_player_ended=1;
+				midi_player_playing=0;
+				return;
+			}
+		}
+		jack_ringbuffer_read_advance(midi_player_ring, sizeof(rec));
+	}
+
+	//Wait for the loader after load or seek
+	if (!rt->primed) return;
+	rt->pos=end;
+	midi_player_position=rt->pos-rt->loop_frame;
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,83 @@
+/*
+ * ******************************************************************
+ * ZYNTHIAN PROJECT: ZynMidiRouter Library
+ *
+ * MIDI Player: Streaming SMF player feeding the sequencer input port
+ *
+ * Copyright (C) 2015-2018 Fernando Moyano <jofemodo@zynthian.org>
+ *
+ * ******************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * For a full copy of the GNU General Public License see the LICENSE.txt file.
+ *
+ * ******************************************************************
+ */
+
+#include <stdint.h>
+#include <jack/jack.h>
+
+//-----------------------------------------------------------------------------
+// MIDI Player
+//-----------------------------------------------------------------------------
+//	+ A loader thread reads the memory-mapped SMF, following its tempo map,
+//	  and streams the decoded events, timestamped in frames, through a
+//	  lock-free ring-buffer. Memory is bounded by the ring-buffer size, for
+//	  any file length.
+//	+ The RT thread injects the events into ZMIP_SEQ with their exact frame
+//	  offsets, so they run through the same pipeline as the sequencer input.
+//	+ Seek & load bump a generation counter. Events from older generations
+//	  are dropped by the RT thread while the loader refills the ring-buffer.
+//	+ Notes sounding on stop, seek, loop & end are released with note-off.
+//-----------------------------------------------------------------------------
+
+#define MIDI_PLAYER_ZMIP ZMIP_SEQ
+#define MIDI_PLAYER_RING_SIZE 65536
+#define MIDI_PLAYER_POLL_US 2000
+
+enum midi_player_event_type_enum {
+	MIDI_PLAYER_EVENT=0,
+	//Song restarts from the beginning
+	MIDI_PLAYER_LOOP=1,
+	//Song end => playback stops
+	MIDI_PLAYER_END=2
+};
+
+struct midi_player_event_st {
+	//Stream position => song frame, plus the song length for each loop
+	uint64_t frame;
+	uint32_t gen;
+	uint8_t type;
+	uint8_t size;
+	uint8_t data[3];
+};
+
+int init_midi_player();
+int end_midi_player();
+
+//Return 0 if error
+int load_midi_player(char *fpath);
+int unload_midi_player();
+int start_midi_player();
+int stop_midi_player();
+int is_midi_player_running();
+//Position & length in milliseconds
+int seek_midi_player(uint32_t ms);
+uint32_t get_midi_player_position();
+uint32_t get_midi_player_length();
+void set_midi_player_loop(int loop);
+int get_midi_player_loop();
+
+//RT function => Called from jack process cycle, before zmips processing
+void inject_midi_player_events(jack_nframes_t nframes);
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,315 @@
+/*
+ * ******************************************************************
+ * ZYNTHIAN PROJECT: ZynMidiRouter Library
+ * 
+ * MIDI replay: Feeds recorded MIDI through the router
+ * 
+ * Copyright (C) 2015-2018 Fernando Moyano <jofemodo@zynthian.org>
+ *
+ * ******************************************************************
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * For a full copy of the GNU General Public License see the LICENSE.txt file.
+ * 
+ * ******************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <jack/jack.h>
+
+#include "zynmidirouter.h"
+#include "zynmidicapture.h"
+#include "zynmidireplay.h"
+#include "zynsmf.h"
+
+//-----------------------------------------------------------------------------
+// Replay Events
+//-----------------------------------------------------------------------------
+
+struct midi_replay_event_st *midi_replay_events=NULL;
+int midi_replay_n_events=0;
+int midi_replay_size=0;
+uint32_t midi_replay_sample_rate=0;
+uint32_t midi_replay_buffer_size=0;
+
+//RT state
+int midi_replay_pos=0;
+int midi_replay_started=0;
+jack_nframes_t midi_replay_start_frame=0;
+
+int midi_replay_add_event(uint32_t frame, int izmip, uint8_t *data, int size) {
+	if (izmip<0 || izmip>=MAX_NUM_ZMIPS || size<1 || size>3) return 0;
+	if (midi_replay_n_events>=midi_replay_size) {
+		int n=midi_replay_size ? 2*midi_replay_size : 1024;
+		struct midi_replay_event_st *events=realloc(midi_replay_events, n*sizeof(struct midi_replay_event_st));
+		if (!events) {
+			fprintf (stderr, "ZynMidiRouter: Can't allocate memory for MIDI replay events.\n");
+			return 0;
+		}
+		midi_replay_events=events;
+		midi_replay_size=n;
+	}
+	struct midi_replay_event_st *ev=midi_replay_events+midi_replay_n_events++;
+	ev->frame=frame;
+	ev->zmip=izmip;
+	ev->size=size;
+	memcpy(ev->data, data, size);
+	return 1;
+}
+
+int load_midi_replay_log(char *fpath, int izmip) {
+	struct midi_capture_header_st header;
+	int i, n;
+	struct midi_capture_event_st *events=load_midi_capture(fpath, &header, &n);
+	if (!events) return 0;
+	uint32_t sample_rate=jack_sample_rate ? jack_sample_rate : header.sample_rate;
+	for (i=0;i<n;i++) {
+		//Only input events
+		if (events[i].port & MIDI_CAPTURE_ZMOP) continue;
+		uint64_t frame=(uint32_t)(events[i].frame-header.start_frame);
+		if (sample_rate!=header.sample_rate) frame=frame*sample_rate/header.sample_rate;
+		midi_replay_add_event(frame, izmip>=0 ? izmip : events[i].port, events[i].data, events[i].size);
+	}
+	free(events);
+	midi_replay_sample_rate=header.sample_rate;
+	midi_replay_buffer_size=header.buffer_size;
+	return 1;
+}
+
+int load_midi_replay_smf(char *fpath, int izmip) {
+	struct smf_event_st ev;
+	struct smf_st *smf=smf_open(fpath);
+	if (!smf) return 0;
+	uint64_t sample_rate=jack_sample_rate ? jack_sample_rate : 48000;
+	while (smf_next_event(smf, &ev)==0) {
+		int iz=izmip;
+		if (iz<0) {
+			//Port meta-events from captured SMFs => Only input events
+			if (ev.port<0) iz=ZMIP_MAIN;
+			else if (ev.port & MIDI_CAPTURE_ZMOP) continue;
+			else iz=ev.port;
+		}
+		midi_replay_add_event(ev.time_us*sample_rate/1000000, iz, ev.data, ev.size);
+	}
+	smf_close(smf);
+	midi_replay_sample_rate=sample_rate;
+	midi_replay_buffer_size=0;
+	return 1;
+}
+
+int load_midi_replay(char *fpath, int izmip) {
+	if (midi_replay_running) {
+		fprintf (stderr, "ZynMidiRouter: Can't load MIDI replay while running.\n");
+		return 0;
+	}
+	if (izmip>=MAX_NUM_ZMIPS) {
+		fprintf (stderr, "ZynMidiRouter: Bad input port index (%d).\n", izmip);
+		return 0;
+	}
+	char magic[8];
+	FILE *fp=fopen(fpath, "rb");
+	if (!fp) {
+		fprintf (stderr, "ZynMidiRouter: Can't open MIDI replay file '%s'.\n", fpath);
+		return 0;
+	}
+	int n=fread(magic, 1, 8, fp);
+	fclose(fp);
+
+	unload_midi_replay();
+	if (n==8 && memcmp(magic, MIDI_CAPTURE_MAGIC, 8)==0) return load_midi_replay_log(fpath, izmip);
+	if (n>=4 && memcmp(magic, "MThd", 4)==0) return load_midi_replay_smf(fpath, izmip);
+	fprintf (stderr, "ZynMidiRouter: Unknown MIDI replay file format '%s'.\n", fpath);
+	return 0;
+}
+
+int unload_midi_replay() {
+	if (midi_replay_running) return 0;
+	//The RT thread stops a finished replay by itself => it could be in the cycle that did it
+	wait_midi_cycle();
+	free(midi_replay_events);
+	midi_replay_events=NULL;
+	midi_replay_n_events=0;
+	midi_replay_size=0;
+	return 1;
+}
+
+int get_midi_replay_num_events() {
+	return midi_replay_n_events;
+}
+
+//-----------------------------------------------------------------------------
+// Online Replay
+//-----------------------------------------------------------------------------
+
+int start_midi_replay() {
+	if (midi_replay_running) return 0;
+	if (midi_replay_n_events==0) {
+		fprintf (stderr, "ZynMidiRouter: No MIDI replay events loaded.\n");
+		return 0;
+	}
+	midi_replay_pos=0;
+	midi_replay_started=0;
+	__sync_synchronize();
+	midi_replay_running=1;
+	return 1;
+}
+
+int stop_midi_replay() {
+	if (!midi_replay_running) return 0;
+	midi_replay_running=0;
+	//Events can be unloaded on return => the RT thread must be done with them
+	wait_midi_cycle();
+	return 1;
+}
+
+int is_midi_replay_running() {
+	return midi_replay_running;
+}
+
+//-----------------------------------------------------------------------------
+// RT injection
+//-----------------------------------------------------------------------------
+
+void inject_midi_replay_events(jack_nframes_t nframes) {
+	//Frame offsets are relative to first cycle
+	if (!midi_replay_started) {
+		midi_replay_start_frame=jack_cycle_frame;
+		midi_replay_started=1;
+	}
+	uint32_t offset=jack_cycle_frame-midi_replay_start_frame;
+	while (midi_replay_pos<midi_replay_n_events) {
+		struct midi_replay_event_st *ev=midi_replay_events+midi_replay_pos;
+		if (ev->frame>=offset+nframes) break;
+		//Injection buffer is full => retry next cycle
+		if (!zmip_inject_event(ev->zmip, ev->frame>offset ? ev->frame-offset : 0, ev->data, ev->size)) break;
+		midi_replay_pos++;
+	}
+	if (midi_replay_pos>=midi_replay_n_events) midi_replay_running=0;
+}
+
+//-----------------------------------------------------------------------------
+// Offline Replay
+//-----------------------------------------------------------------------------
+
+int replay_midi_offline(char *fpath, char *out_fpath, uint32_t zmops_mask, int izmip) {
+	struct timespec ts0, ts1;
+	int i;
+	if (jack_client) {
+		fprintf (stderr, "ZynMidiRouter: Offline MIDI replay can't run with a jack client.\n");
+		return 0;
+	}
+	if (!load_midi_replay(fpath, izmip)) return 0;
+
+	//Use the recorded sample rate, if not set
+	if (jack_sample_rate==0) jack_sample_rate=midi_replay_sample_rate;
+
+	//Use the recorded buffer size, so events are split in cycles as recorded
+	jack_nframes_t nframes=jack_buffer_size;
+	if (nframes==0) nframes=midi_replay_buffer_size;
+	if (nframes==0) nframes=MIDI_REPLAY_DEFAULT_BUFFER_SIZE;
+	jack_buffer_size=nframes;
+
+	//All output ports are connected
+	for (i=0;i<MAX_NUM_ZMOPS;i++) zmops[i].n_connections=1;
+
+	if (out_fpath && !start_midi_capture(out_fpath, MIDI_CAPTURE_FORMAT_LOG, 0, zmops_mask)) return 0;
+	if (!start_midi_replay()) {
+		if (out_fpath) stop_midi_capture();
+		return 0;
+	}
+
+	uint32_t n_cycles=0;
+	uint32_t n_zmop_events=0;
+	for (i=0;i<MAX_NUM_ZMOPS;i++) n_zmop_events-=zynmidi_stats.zmop_events[i];
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	while (midi_replay_running) {
+		//Let the capture thread keep up
+		while (out_fpath && get_midi_capture_pending()>MIDI_CAPTURE_RING_SIZE/2) usleep(1000);
+		if (jack_process(nframes, NULL)<0) break;
+		jack_cycle_frame+=nframes;
+		n_cycles++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	for (i=0;i<MAX_NUM_ZMOPS;i++) n_zmop_events+=zynmidi_stats.zmop_events[i];
+	if (out_fpath) stop_midi_capture();
+
+	double secs=(ts1.tv_sec-ts0.tv_sec)+(ts1.tv_nsec-ts0.tv_nsec)/1e9;
+	double rt_secs=(double)n_cycles*nframes/(jack_sample_rate ? jack_sample_rate : 48000);
+	fprintf(stdout, "ZynMidiRouter: Replayed %d events (%u output) in %u cycles of %u frames => %.3f ms, %.0f events/s, x%.0f realtime\n",
+		midi_replay_n_events, n_zmop_events, n_cycles, nframes, secs*1000, secs>0 ? midi_replay_n_events/secs : 0, secs>0 ? rt_secs/secs : 0);
+	return 1;
+}
+
+//-----------------------------------------------------------------------------
+// Capture Diff
+//-----------------------------------------------------------------------------
+
+int diff_midi_capture(char *fpath, char *golden_fpath, uint32_t zmops_mask) {
+	struct midi_capture_header_st header[2];
+	struct midi_capture_event_st *events[2];
+	int n[2];
+	int i, j[2]={0,0}, k;
+
+	events[0]=load_midi_capture(fpath, header, n);
+	if (!events[0]) return -1;
+	events[1]=load_midi_capture(golden_fpath, header+1, n+1);
+	if (!events[1]) {
+		free(events[0]);
+		return -1;
+	}
+
+	int n_diffs=0;
+	while (1) {
+		//Get next output event from both logs
+		struct midi_capture_event_st *ev[2]={NULL,NULL};
+		for (k=0;k<2;k++) {
+			while (j[k]<n[k]) {
+				struct midi_capture_event_st *e=events[k]+j[k]++;
+				if ((e->port & MIDI_CAPTURE_ZMOP) && (zmops_mask & (1<<(e->port & ~MIDI_CAPTURE_ZMOP)))) {
+					ev[k]=e;
+					break;
+				}
+			}
+		}
+		if (!ev[0] && !ev[1]) break;
+
+		uint32_t frame[2]={0,0};
+		for (k=0;k<2;k++) if (ev[k]) frame[k]=ev[k]->frame-header[k].start_frame;
+		if (ev[0] && ev[1] && frame[0]==frame[1] && ev[0]->port==ev[1]->port && ev[0]->size==ev[1]->size
+			&& memcmp(ev[0]->data, ev[1]->data, ev[0]->size)==0) continue;
+
+		if (n_diffs<MIDI_REPLAY_MAX_DIFFS_SHOWN) {
+			fprintf(stdout, "ZynMidiRouter: Diff #%d =>", n_diffs);
+			for (k=0;k<2;k++) {
+				if (!ev[k]) fprintf(stdout, " %s: -", k ? "golden" : "output");
+				else {
+					fprintf(stdout, " %s: [%u] zmop %d:", k ? "golden" : "output", frame[k], ev[k]->port & ~MIDI_CAPTURE_ZMOP);
+					for (i=0;i<ev[k]->size;i++) fprintf(stdout, " %02X", ev[k]->data[i]);
+				}
+				if (!k) fprintf(stdout, " |");
+			}
+			fprintf(stdout, "\n");
+		}
+		n_diffs++;
+	}
+	free(events[0]);
+	free(events[1]);
+	fprintf(stdout, "ZynMidiRouter: %d differences found\n", n_diffs);
+	return n_diffs;
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,70 @@
+/*
+ * ******************************************************************
+ * ZYNTHIAN PROJECT: ZynMidiRouter Library
+ * 
+ * MIDI replay: Feeds recorded MIDI through the router
+ * 
+ * Copyright (C) 2015-2018 Fernando Moyano <jofemodo@zynthian.org>
+ *
+ * ******************************************************************
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * For a full copy of the GNU General Public License see the LICENSE.txt file.
+ * 
+ * ******************************************************************
+ */
+
+#include <stdint.h>
+#include <jack/jack.h>
+
+//-----------------------------------------------------------------------------
+// MIDI Replay
+//-----------------------------------------------------------------------------
+//	+ Loads a capture log (zmip events) or a SMF and injects the events into
+//	  the zmips, with the original frame offsets, so they run through the
+//	  same jack_process_zmip pipeline as live input.
+//	+ Online: events are injected from the jack process cycle.
+//	+ Offline: cycles are run back-to-back (no jack client), capturing the
+//	  zmops output to a log that can be compared with a golden log.
+//-----------------------------------------------------------------------------
+
+#define MIDI_REPLAY_DEFAULT_BUFFER_SIZE 256
+#define MIDI_REPLAY_MAX_DIFFS_SHOWN 10
+
+struct midi_replay_event_st {
+	uint32_t frame;
+	uint8_t zmip;
+	uint8_t size;
+	uint8_t data[3];
+};
+
+volatile int midi_replay_running;
+
+//Load log or SMF file. izmip<0 => use the recorded zmip (log) or port (SMF)
+int load_midi_replay(char *fpath, int izmip);
+int unload_midi_replay();
+int get_midi_replay_num_events();
+
+int start_midi_replay();
+int stop_midi_replay();
+int is_midi_replay_running();
+
+//RT function => Called from jack process cycle, before zmips processing
+void inject_midi_replay_events(jack_nframes_t nframes);
+
+//Offline replay => Router must be initialized with init_zynmidirouter_offline
+int replay_midi_offline(char *fpath, char *out_fpath, uint32_t zmops_mask, int izmip);
+
+//Compare zmop events from 2 capture logs => Return number of differences (-1 if error)
+int diff_midi_capture(char *fpath, char *golden_fpath, uint32_t zmops_mask);
+
+//-----------------------------------------------------------------------------
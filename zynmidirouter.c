@@ -30,12 +30,20 @@
 #include <math.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <jack/jack.h>
 #include <jack/midiport.h>
 #include <jack/ringbuffer.h>
 #include <lo/lo.h>
 
 #include "zyncoder.h"
+#include "zynmidicapture.h"
+#include "zynmidibcast.h"
+#include "zynmidistate.h"
+#include "zynmidiclock.h"
+#include "zynmidisched.h"
+#include "zynmidiplayer.h"
+#include "zynmidireplay.h"
 
 //-----------------------------------------------------------------------------
 // Library Initialization
@@ -46,13 +54,40 @@ int init_zynmidirouter() {
 
 	if (!init_zynmidi_buffer()) return 0;
 	if (!init_midi_router()) return 0;
+	if (!init_midi_capture()) return 0;
+	init_midi_clock();
+	if (!init_midi_sched()) return 0;
+	if (!init_midi_player()) return 0;
+	//Shared memory exports are optional => the router works without them
+	init_zynmidi_bcast();
+	init_zynmidi_state();
 	if (!init_jack_midi("ZynMidiRouter")) return 0; //ZynMidiRouter
 	return 1;
 }
 
+int init_zynmidirouter_offline(jack_nframes_t sample_rate, jack_nframes_t buffer_size) {
+	jack_client=NULL;
+	jack_sample_rate=sample_rate;
+	jack_buffer_size=buffer_size;
+	jack_cycle_frame=0;
+	if (!init_zynmidi_buffer()) return 0;
+	if (!init_midi_router()) return 0;
+	if (!init_midi_capture()) return 0;
+	init_midi_clock();
+	if (!init_midi_sched()) return 0;
+	if (!init_midi_player()) return 0;
+	if (!init_zynmidi_ports()) return 0;
+	return 1;
+}
+
 int end_zynmidirouter() {
 	if (!end_midi_router()) return 0;
 	if (!end_jack_midi()) return 0;
+	end_zynmidi_bcast();
+	end_zynmidi_state();
+	if (!end_midi_capture()) return 0;
+	if (!end_midi_player()) return 0;
+	if (!end_midi_sched()) return 0;
 	return 1;
 }
 
@@ -66,36 +101,65 @@ int init_midi_router() {
 	midi_filter.master_chan=-1;
 	midi_filter.active_chan=-1;
 	midi_filter.last_active_chan=-1;
+	midi_filter.active_chan_src=-1;
 	midi_filter.tuning_pitchbend=-1;
 	midi_learning_mode=0;
 	midi_ctrl_automode=1;
+
+	midi_filter.preset=midi_presets;
+	midi_preset_handoff=MIDI_PRESET_HANDOFF_KEEP;
+	midi_preset_pending=-1;
+	reset_midi_preset_trigger();
 	
 	for (i=0;i<16;i++) {
-		midi_filter.transpose[i]=0;
+		midi_filter.preset->transpose[i]=0;
 		midi_filter.last_pb_val[i]=8192;
 	}
 	for (i=0;i<16;i++) {
 		for (j=0;j<16;j++) {
-			midi_filter.clone[i][j].enabled=0;
-			memset(midi_filter.clone[i][j].cc, 0, 128);
+			midi_filter.preset->clone[i][j].enabled=0;
+			memset(midi_filter.preset->clone[i][j].cc, 0, 128);
 			for (k=0;k<sizeof(default_cc_to_clone);k++) {
-				midi_filter.clone[i][j].cc[default_cc_to_clone[k] & 0x7F]=1;
+				midi_filter.preset->clone[i][j].cc[default_cc_to_clone[k] & 0x7F]=1;
 			}
 		}
 	}
 	for (i=0;i<8;i++) {
 		for (j=0;j<16;j++) {
 			for (k=0;k<128;k++) {
-				midi_filter.event_map[i][j][k].type=THRU_EVENT;
-				midi_filter.event_map[i][j][k].chan=j;
-				midi_filter.event_map[i][j][k].num=k;
+				midi_filter.preset->event_map[i][j][k].type=THRU_EVENT;
+				midi_filter.preset->event_map[i][j][k].chan=j;
+				midi_filter.preset->event_map[i][j][k].num=k;
+				midi_filter.preset->event_map[i][j][k].multimap=0;
+				midi_filter.preset->event_map[i][j][k].curve=0;
 			}
 		}
 	}
+	memset(midi_filter.preset->multimap_tables, 0, sizeof(midi_filter.preset->multimap_tables));
+	midi_filter.preset->multimap_table=0;
+	memset(midi_filter.preset->curves, 0, sizeof(midi_filter.preset->curves));
+	rebuild_rev_event_map(midi_filter.preset);
 	memset(midi_filter.ctrl_mode, 0, 16*128);
 	memset(midi_filter.ctrl_relmode_count, 0, 16*128);
 	memset(midi_filter.last_ctrl_val, 0, 16*128);
 	memset(midi_filter.note_state, 0, 16*128);
+	memset(midi_filter.note_preset, 0xFF, 16*128);
+	memset(midi_filter.zone_note, 0, sizeof(midi_filter.zone_note));
+	memset(midi_filter.zone_note_target, 0xFF, sizeof(midi_filter.zone_note_target));
+	memset(midi_filter.hires_mode, 0, sizeof(midi_filter.hires_mode));
+	memset(midi_filter.ctrl_enc, MIDI_CTRL_ENC_AUTO, sizeof(midi_filter.ctrl_enc));
+	memset(midi_filter.ctrl_enc_val, 0, sizeof(midi_filter.ctrl_enc_val));
+	for (i=0;i<16;i++) {
+		for (j=0;j<128;j++) midi_filter.ctrl_enc_step[i][j]=MIDI_CTRL_ENC_STEP;
+	}
+	init_midi_ctrl_enc_delta();
+	memset(midi_filter.hires, 0, sizeof(midi_filter.hires));
+	memset(midi_filter.preset->zone_tables, 0, sizeof(midi_filter.preset->zone_tables));
+	midi_filter.preset->zone_table=0;
+	for (i=0;i<16;i++) {
+		midi_filter.velocity_curve[i][MIDI_VELOCITY_NOTE_ON].active=-1;
+		midi_filter.velocity_curve[i][MIDI_VELOCITY_NOTE_OFF].active=-1;
+	}
 
 	return 1;
 }
@@ -167,7 +231,7 @@ void set_midi_filter_transpose(uint8_t chan, int offset) {
 		fprintf (stderr, "ZynMidiRouter: MIDI Transpose offset (%d) is out of range!\n",offset);
 		return;
 	}
-	midi_filter.transpose[chan]=offset;
+	midi_filter.preset->transpose[chan]=offset;
 }
 
 int get_midi_filter_transpose(uint8_t chan) {
@@ -175,7 +239,7 @@ int get_midi_filter_transpose(uint8_t chan) {
 		fprintf (stderr, "ZynMidiRouter: MIDI Transpose channel (%d) is out of range!\n",chan);
 		return 0;
 	}
-	return midi_filter.transpose[chan];
+	return midi_filter.preset->transpose[chan];
 }
 
 //MIDI filter clone
@@ -188,7 +252,7 @@ void set_midi_filter_clone(uint8_t chan_from, uint8_t chan_to, int v) {
 		fprintf (stderr, "ZynMidiRouter: MIDI clone chan_to (%d) is out of range!\n",chan_to);
 		return;
 	}
-	midi_filter.clone[chan_from][chan_to].enabled=v;
+	midi_filter.preset->clone[chan_from][chan_to].enabled=v;
 }
 
 int get_midi_filter_clone(uint8_t chan_from, uint8_t chan_to) {
@@ -200,7 +264,7 @@ int get_midi_filter_clone(uint8_t chan_from, uint8_t chan_to) {
 		fprintf (stderr, "ZynMidiRouter: MIDI clone chan_to (%d) is out of range!\n",chan_to);
 		return 0;
 	}
-	return midi_filter.clone[chan_from][chan_to].enabled;
+	return midi_filter.preset->clone[chan_from][chan_to].enabled;
 }
 
 void reset_midi_filter_clone(uint8_t chan_from) {
@@ -210,10 +274,10 @@ void reset_midi_filter_clone(uint8_t chan_from) {
 	}
 	int j, k;
 	for (j=0;j<16;j++) {
-		midi_filter.clone[chan_from][j].enabled=0;
-		memset(midi_filter.clone[chan_from][j].cc, 0, 128);
+		midi_filter.preset->clone[chan_from][j].enabled=0;
+		memset(midi_filter.preset->clone[chan_from][j].cc, 0, 128);
 		for (k=0;k<sizeof(default_cc_to_clone);k++) {
-			midi_filter.clone[chan_from][j].cc[default_cc_to_clone[k] & 0x7F]=1;
+			midi_filter.preset->clone[chan_from][j].cc[default_cc_to_clone[k] & 0x7F]=1;
 		}
 	}
 }
@@ -229,7 +293,7 @@ void set_midi_filter_clone_cc(uint8_t chan_from, uint8_t chan_to, uint8_t cc[128
 	}
 	int i;
 	for (i=0; i<128; i++) {
-		midi_filter.clone[chan_from][chan_to].cc[i]=cc[i];
+		midi_filter.preset->clone[chan_from][chan_to].cc[i]=cc[i];
 	}
 }
 
@@ -242,7 +306,7 @@ uint8_t *get_midi_filter_clone_cc(uint8_t chan_from, uint8_t chan_to) {
 		fprintf (stderr, "ZynMidiRouter: MIDI clone chan_to (%d) is out of range!\n",chan_to);
 		return NULL;
 	}
-	return midi_filter.clone[chan_from][chan_to].cc;
+	return midi_filter.preset->clone[chan_from][chan_to].cc;
 }
 
 
@@ -257,9 +321,9 @@ void reset_midi_filter_clone_cc(uint8_t chan_from, uint8_t chan_to) {
 	}
 
 	int i;
-	memset(midi_filter.clone[chan_from][chan_to].cc, 0, 128);
+	memset(midi_filter.preset->clone[chan_from][chan_to].cc, 0, 128);
 	for (i=0;i<sizeof(default_cc_to_clone);i++) {
-		midi_filter.clone[chan_from][chan_to].cc[default_cc_to_clone[i] & 0x7F]=1;
+		midi_filter.preset->clone[chan_from][chan_to].cc[default_cc_to_clone[i] & 0x7F]=1;
 	}
 }
 
@@ -282,13 +346,124 @@ int validate_midi_event(struct midi_event_st *ev) {
 	return 1;
 }
 
+//Target of an event_map arrow, as emitted by the forward mapping => Return 0 if ignored
+int get_event_map_target(int t, uint8_t chan, uint8_t num, struct midi_event_st *map, struct midi_event_st *target) {
+	if (map->type==IGNORE_EVENT || map->multimap) return 0;
+	if (map->type==THRU_EVENT || map->type==NONE_EVENT) {
+		target->type=t | 0x8;
+		target->chan=chan;
+		target->num=num;
+	} else {
+		target->type=(map->type==SWAP_EVENT) ? (t | 0x8) : map->type;
+		target->chan=map->chan;
+		if (target->type==PROG_CHANGE || target->type==CHAN_PRESS) target->num=num;
+		else if (target->type==PITCH_BENDING) target->num=0;
+		else target->num=map->num;
+	}
+	return 1;
+}
+
+//Explicit maps & swaps take precedence over THRU arrows when several sources share a target
+int get_rev_event_map_priority(struct mf_preset_st *preset, struct midi_event_st *rev) {
+	if (rev->type==NONE_EVENT) return 0;
+	struct midi_event_st *map=&preset->event_map[rev->type & 0x7][rev->chan][rev->num];
+	if (map->type==THRU_EVENT && !map->multimap) return 1;
+	return 2;
+}
+
+//i_target => index+1 of the one-to-many target (0 => single arrow)
+void set_rev_event_map_source(struct mf_preset_st *preset, struct midi_event_st *target, int t, uint8_t chan, uint8_t num, int i_target) {
+	struct midi_event_st *rev=&preset->rev_event_map[target->type & 0x7][target->chan][target->num];
+	struct midi_event_st src={ .type=t | 0x8, .chan=chan, .num=num, .multimap=i_target };
+	if (get_rev_event_map_priority(preset, &src)>=get_rev_event_map_priority(preset, rev)) *rev=src;
+}
+
+//Target of a one-to-many mapping target, as emitted by the forward mapping
+void get_multimap_target(struct mf_target_st *mt, struct midi_event_st *target) {
+	target->type=mt->type;
+	target->chan=mt->chan;
+	if (mt->type==PROG_CHANGE || mt->type==CHAN_PRESS || mt->type==PITCH_BENDING) target->num=0;
+	else target->num=mt->num;
+}
+
+//Add the arrows of a source event to the reverse index => only "match" target if not NULL
+void add_rev_event_map_arrows(struct mf_preset_st *preset, int i, int j, int k, struct midi_event_st *match) {
+	struct midi_event_st *map=&preset->event_map[i][j][k];
+	struct midi_event_st t;
+	if (map->multimap) {
+		struct mf_multimap_table_st *mt=get_multimap_table(preset);
+		struct mf_multimap_st *mm=mt->multimaps+map->multimap-1;
+		int n;
+		for (n=0;n<mm->n_targets;n++) {
+			get_multimap_target(mt->pool+mm->first+n, &t);
+			if (!match || (t.type==match->type && t.chan==match->chan && t.num==match->num)) set_rev_event_map_source(preset, &t, i, j, k, n+1);
+		}
+	} else if (get_event_map_target(i, j, k, map, &t)) {
+		if (!match || (t.type==match->type && t.chan==match->chan && t.num==match->num)) set_rev_event_map_source(preset, &t, i, j, k, 0);
+	}
+}
+
+//Find the best source for a target => Only used when its current source is unmapped
+void find_rev_event_map_source(struct mf_preset_st *preset, struct midi_event_st *target) {
+	int i,j,k;
+	preset->rev_event_map[target->type & 0x7][target->chan][target->num].type=NONE_EVENT;
+	for (i=0;i<8;i++) {
+		for (j=0;j<16;j++) {
+			for (k=0;k<128;k++) add_rev_event_map_arrows(preset, i, j, k, target);
+		}
+	}
+}
+
+void rebuild_rev_event_map(struct mf_preset_st *preset) {
+	int i,j,k;
+	for (i=0;i<8;i++) {
+		for (j=0;j<16;j++) {
+			for (k=0;k<128;k++) preset->rev_event_map[i][j][k].type=NONE_EVENT;
+		}
+	}
+	for (i=0;i<8;i++) {
+		for (j=0;j<16;j++) {
+			for (k=0;k<128;k++) add_rev_event_map_arrows(preset, i, j, k, NULL);
+		}
+	}
+}
+
+//Set an event_map arrow & keep the reverse index updated
+void set_event_map_arrow(int t, uint8_t chan, uint8_t num, enum midi_event_type_enum type_to, uint8_t chan_to, uint8_t num_to) {
+	struct mf_preset_st *preset=midi_filter.preset;
+	struct midi_event_st *event_map=&preset->event_map[t][chan][num];
+	struct midi_event_st target;
+	//A single arrow replaces the one-to-many mapping
+	if (event_map->multimap) {
+		int im=event_map->multimap-1;
+		event_map->multimap=0;
+		__sync_synchronize();
+		struct mf_multimap_table_st *mt=edit_multimap_table(preset, 0);
+		free_midi_multimap(mt, im);
+		publish_multimap_table(preset, mt);
+		event_map->type=type_to;
+		event_map->chan=chan_to;
+		event_map->num=num_to;
+		rebuild_rev_event_map(preset);
+		return;
+	}
+	struct midi_event_st old=*event_map;
+	if (old.type==type_to && old.chan==chan_to && old.num==num_to) return;
+	event_map->type=type_to;
+	event_map->chan=chan_to;
+	event_map->num=num_to;
+	//Remove old arrow from the index
+	if (get_event_map_target(t, chan, num, &old, &target)) {
+		struct midi_event_st *rev=&preset->rev_event_map[target.type & 0x7][target.chan][target.num];
+		if (rev->type==(t | 0x8) && rev->chan==chan && rev->num==num) find_rev_event_map_source(preset, &target);
+	}
+	//Add new arrow
+	if (get_event_map_target(t, chan, num, event_map, &target)) set_rev_event_map_source(preset, &target, t, chan, num, 0);
+}
+
 void set_midi_filter_event_map_st(struct midi_event_st *ev_from, struct midi_event_st *ev_to) {
 	if (validate_midi_event(ev_from) && validate_midi_event(ev_to)) {
-		//memcpy(&midi_filter.event_map[ev_from->type&0x7][ev_from->chan][ev_from->num],ev_to,sizeof(ev_to));
-		struct midi_event_st *event_map=&midi_filter.event_map[ev_from->type&0x7][ev_from->chan][ev_from->num];
-		event_map->type=ev_to->type;
-		event_map->chan=ev_to->chan;
-		event_map->num=ev_to->num;
+		set_event_map_arrow(ev_from->type & 0x7, ev_from->chan, ev_from->num, ev_to->type, ev_to->chan, ev_to->num);
 	}
 }
 
@@ -301,7 +476,8 @@ void set_midi_filter_event_map(enum midi_event_type_enum type_from, uint8_t chan
 
 void set_midi_filter_event_ignore_st(struct midi_event_st *ev_from) {
 	if (validate_midi_event(ev_from)) {
-		midi_filter.event_map[ev_from->type&0x7][ev_from->chan][ev_from->num].type=IGNORE_EVENT;
+		struct midi_event_st *event_map=&midi_filter.preset->event_map[ev_from->type&0x7][ev_from->chan][ev_from->num];
+		set_event_map_arrow(ev_from->type & 0x7, ev_from->chan, ev_from->num, IGNORE_EVENT, event_map->chan, event_map->num);
 	}
 }
 
@@ -312,7 +488,7 @@ void set_midi_filter_event_ignore(enum midi_event_type_enum type_from, uint8_t c
 
 struct midi_event_st *get_midi_filter_event_map_st(struct midi_event_st *ev_from) {
 	if (validate_midi_event(ev_from)) {
-		return &midi_filter.event_map[ev_from->type&0x7][ev_from->chan][ev_from->num];
+		return &midi_filter.preset->event_map[ev_from->type&0x7][ev_from->chan][ev_from->num];
 	}
 	return NULL;
 }
@@ -324,9 +500,7 @@ struct midi_event_st *get_midi_filter_event_map(enum midi_event_type_enum type_f
 
 void del_midi_filter_event_map_st(struct midi_event_st *ev_from) {
 	if (validate_midi_event(ev_from)) {
-		midi_filter.event_map[ev_from->type&0x7][ev_from->chan][ev_from->num].type=THRU_EVENT;
-		midi_filter.event_map[ev_from->type&0x7][ev_from->chan][ev_from->num].chan=ev_from->chan;
-		midi_filter.event_map[ev_from->type&0x7][ev_from->chan][ev_from->num].num=ev_from->num;
+		set_event_map_arrow(ev_from->type & 0x7, ev_from->chan, ev_from->num, THRU_EVENT, ev_from->chan, ev_from->num);
 	}
 }
 
@@ -340,12 +514,525 @@ void reset_midi_filter_event_map() {
 	for (i=0;i<8;i++) {
 		for (j=0;j<16;j++) {
 			for (k=0;k<128;k++) {
-				midi_filter.event_map[i][j][k].type=THRU_EVENT;
-				midi_filter.event_map[i][j][k].chan=j;
-				midi_filter.event_map[i][j][k].num=k;
+				midi_filter.preset->event_map[i][j][k].type=THRU_EVENT;
+				midi_filter.preset->event_map[i][j][k].chan=j;
+				midi_filter.preset->event_map[i][j][k].num=k;
+				midi_filter.preset->event_map[i][j][k].multimap=0;
+				midi_filter.preset->event_map[i][j][k].curve=0;
+			}
+		}
+	}
+	__sync_synchronize();
+	publish_multimap_table(midi_filter.preset, edit_multimap_table(midi_filter.preset, 1));
+	memset(midi_filter.preset->curves, 0, sizeof(midi_filter.preset->curves));
+	rebuild_rev_event_map(midi_filter.preset);
+}
+
+struct midi_event_st *get_midi_filter_rev_event_map(enum midi_event_type_enum type_to, uint8_t chan_to, uint8_t num_to) {
+	struct midi_event_st ev_to={ .type=type_to, .chan=chan_to, .num=num_to };
+	if (!validate_midi_event(&ev_to)) return NULL;
+	struct midi_event_st *rev=&midi_filter.preset->rev_event_map[type_to & 0x7][chan_to][num_to];
+	if (rev->type==NONE_EVENT) return NULL;
+	return rev;
+}
+
+//One-to-many event mapping
+
+int validate_mf_target(struct mf_target_st *target) {
+	if (target->type<NOTE_OFF || target->type>PITCH_BENDING) {
+		fprintf (stderr, "ZynMidiRouter: MIDI multimap target type (%d) is not valid!\n",target->type);
+		return 0;
+	}
+	if (target->chan>15 || target->num>127 || target->val_min>127 || target->val_max>127 || target->curve>MAX_MIDI_CURVES) {
+		fprintf (stderr, "ZynMidiRouter: MIDI multimap target (%d, %d, %d-%d) is out of range!\n",target->chan,target->num,target->val_min,target->val_max);
+		return 0;
+	}
+	return 1;
+}
+
+struct mf_multimap_table_st *get_multimap_table(struct mf_preset_st *preset) {
+	return preset->multimap_tables+__atomic_load_n(&preset->multimap_table, __ATOMIC_ACQUIRE);
+}
+
+struct mf_multimap_table_st *edit_multimap_table(struct mf_preset_st *preset, int clear) {
+	struct mf_multimap_table_st *mt=preset->multimap_tables+(preset->multimap_table ? 0 : 1);
+	if (clear) memset(mt, 0, sizeof(struct mf_multimap_table_st));
+	else memcpy(mt, get_multimap_table(preset), sizeof(struct mf_multimap_table_st));
+	return mt;
+}
+
+//The old table is reused by the next edit => wait until the RT thread can't be using it
+void publish_multimap_table(struct mf_preset_st *preset, struct mf_multimap_table_st *mt) {
+	__atomic_store_n(&preset->multimap_table, (int)(mt-preset->multimap_tables), __ATOMIC_RELEASE);
+	wait_midi_cycle();
+}
+
+//Remove a target list, compacting the pool => only on the inactive table!
+void free_midi_multimap(struct mf_multimap_table_st *mt, int im) {
+	struct mf_multimap_st *mm=mt->multimaps+im;
+	int first=mm->first;
+	int n=mm->n_targets;
+	int i;
+	memmove(mt->pool+first, mt->pool+first+n, (mt->n_pool-first-n)*sizeof(struct mf_target_st));
+	mt->n_pool-=n;
+	for (i=0;i<MAX_MIDI_MULTIMAPS;i++) {
+		if (mt->multimaps[i].used && mt->multimaps[i].first>first) mt->multimaps[i].first-=n;
+	}
+	mm->used=0;
+	mm->n_targets=0;
+	mm->first=0;
+}
+
+int set_midi_filter_event_multimap(enum midi_event_type_enum type_from, uint8_t chan_from, uint8_t num_from, struct mf_target_st *targets, int n_targets) {
+	struct midi_event_st ev_from={ .type=type_from, .chan=chan_from, .num=num_from };
+	if (!validate_midi_event(&ev_from)) return 0;
+	if (n_targets<1 || n_targets>MAX_MIDI_MULTIMAP_TARGETS) {
+		fprintf (stderr, "ZynMidiRouter: MIDI multimap number of targets (%d) is out of range!\n",n_targets);
+		return 0;
+	}
+	int i;
+	for (i=0;i<n_targets;i++) {
+		if (!validate_mf_target(targets+i)) return 0;
+	}
+	struct mf_preset_st *preset=midi_filter.preset;
+	struct midi_event_st *event_map=&preset->event_map[type_from & 0x7][chan_from][num_from];
+	int im=event_map->multimap-1;
+	struct mf_multimap_table_st *mt=get_multimap_table(preset);
+	//Check free space, counting the current list
+	int n_free=MIDI_MULTIMAP_POOL_SIZE-mt->n_pool;
+	if (im>=0) n_free+=mt->multimaps[im].n_targets;
+	if (n_targets>n_free) {
+		fprintf (stderr, "ZynMidiRouter: MIDI multimap pool is full!\n");
+		return 0;
+	}
+	if (im<0) {
+		for (im=0;im<MAX_MIDI_MULTIMAPS;im++) {
+			if (!mt->multimaps[im].used) break;
+		}
+		if (im>=MAX_MIDI_MULTIMAPS) {
+			fprintf (stderr, "ZynMidiRouter: Too many MIDI multimaps!\n");
+			return 0;
+		}
+	}
+	//Replace the list on the inactive table & publish it => the active one is untouched
+	mt=edit_multimap_table(preset, 0);
+	if (mt->multimaps[im].used) free_midi_multimap(mt, im);
+	struct mf_multimap_st *mm=mt->multimaps+im;
+	memcpy(mt->pool+mt->n_pool, targets, n_targets*sizeof(struct mf_target_st));
+	mm->first=mt->n_pool;
+	mm->n_targets=n_targets;
+	mm->used=1;
+	mt->n_pool+=n_targets;
+	publish_multimap_table(preset, mt);
+	event_map->multimap=im+1;
+	rebuild_rev_event_map(preset);
+	return 1;
+}
+
+int add_midi_filter_event_multimap_target(enum midi_event_type_enum type_from, uint8_t chan_from, uint8_t num_from, enum midi_event_type_enum type_to, uint8_t chan_to, uint8_t num_to, uint8_t val_min, uint8_t val_max) {
+	struct mf_target_st targets[MAX_MIDI_MULTIMAP_TARGETS];
+	int n=get_midi_filter_event_multimap(type_from, chan_from, num_from, targets, MAX_MIDI_MULTIMAP_TARGETS);
+	if (n>=MAX_MIDI_MULTIMAP_TARGETS) {
+		fprintf (stderr, "ZynMidiRouter: Too many MIDI multimap targets!\n");
+		return 0;
+	}
+	targets[n].type=type_to;
+	targets[n].chan=chan_to;
+	targets[n].num=num_to;
+	targets[n].val_min=val_min;
+	targets[n].val_max=val_max;
+	targets[n].curve=0;
+	return set_midi_filter_event_multimap(type_from, chan_from, num_from, targets, n+1);
+}
+
+int get_midi_filter_event_multimap(enum midi_event_type_enum type_from, uint8_t chan_from, uint8_t num_from, struct mf_target_st *targets, int max_targets) {
+	struct midi_event_st ev_from={ .type=type_from, .chan=chan_from, .num=num_from };
+	if (!validate_midi_event(&ev_from)) return 0;
+	struct mf_preset_st *preset=midi_filter.preset;
+	int im=preset->event_map[type_from & 0x7][chan_from][num_from].multimap-1;
+	if (im<0) return 0;
+	struct mf_multimap_table_st *mt=get_multimap_table(preset);
+	int n=mt->multimaps[im].n_targets;
+	if (n>max_targets) n=max_targets;
+	memcpy(targets, mt->pool+mt->multimaps[im].first, n*sizeof(struct mf_target_st));
+	return n;
+}
+
+int del_midi_filter_event_multimap(enum midi_event_type_enum type_from, uint8_t chan_from, uint8_t num_from) {
+	struct midi_event_st ev_from={ .type=type_from, .chan=chan_from, .num=num_from };
+	if (!validate_midi_event(&ev_from)) return 0;
+	struct mf_preset_st *preset=midi_filter.preset;
+	struct midi_event_st *event_map=&preset->event_map[type_from & 0x7][chan_from][num_from];
+	if (!event_map->multimap) return 0;
+	int im=event_map->multimap-1;
+	event_map->multimap=0;
+	__sync_synchronize();
+	struct mf_multimap_table_st *mt=edit_multimap_table(preset, 0);
+	free_midi_multimap(mt, im);
+	publish_multimap_table(preset, mt);
+	rebuild_rev_event_map(preset);
+	return 1;
+}
+
+void reset_midi_filter_event_multimaps() {
+	struct mf_preset_st *preset=midi_filter.preset;
+	int i,j,k;
+	for (i=0;i<8;i++) {
+		for (j=0;j<16;j++) {
+			for (k=0;k<128;k++) preset->event_map[i][j][k].multimap=0;
+		}
+	}
+	__sync_synchronize();
+	publish_multimap_table(preset, edit_multimap_table(preset, 1));
+	rebuild_rev_event_map(preset);
+}
+
+//Value curves
+
+//Compile a curve to a LUT => floating point is only used here, out of the RT thread
+void compile_midi_curve(uint8_t *lut, int curve, uint8_t val_min, uint8_t val_max) {
+	int i;
+	for (i=0;i<128;i++) {
+		double x=i/127.0;
+		double y;
+		switch (curve) {
+			case MIDI_CURVE_LOG:
+				y=log10(1.0+9.0*x);
+				break;
+			case MIDI_CURVE_EXP:
+				y=(pow(10.0,x)-1.0)/9.0;
+				break;
+			default:
+				y=x;
+		}
+		lut[i]=(uint8_t)lround(val_min+y*((int)val_max-val_min));
+	}
+}
+
+//Inverse of a LUT => the input whose output is nearest to every value (ties => nearest input)
+void compile_midi_curve_inverse(uint8_t *inv_lut, uint8_t *lut) {
+	int i,j;
+	for (i=0;i<128;i++) {
+		int best=0;
+		for (j=1;j<128;j++) {
+			int d=abs((int)lut[j]-i)-abs((int)lut[best]-i);
+			if (d<0 || (d==0 && abs(j-i)<abs(best-i))) best=j;
+		}
+		inv_lut[i]=best;
+	}
+}
+
+//Inverse of the linear scaling of a one-to-many target
+uint8_t unscale_mf_target_val(struct mf_target_st *target, uint8_t val) {
+	int range=(int)target->val_max-target->val_min;
+	if (!range) return val;
+	int x=(2*((int)val-target->val_min)*127+range)/(2*range);
+	if (x<0) return 0;
+	if (x>127) return 127;
+	return x;
+}
+
+//Unused curves are found by scanning the mappings => only when the table is full
+void gc_midi_curves(struct mf_preset_st *preset) {
+	uint8_t used[MAX_MIDI_CURVES];
+	int i,j,k;
+	memset(used, 0, sizeof(used));
+	for (i=0;i<8;i++) {
+		for (j=0;j<16;j++) {
+			for (k=0;k<128;k++) {
+				if (preset->event_map[i][j][k].curve) used[preset->event_map[i][j][k].curve-1]=1;
 			}
 		}
 	}
+	struct mf_multimap_table_st *mt=get_multimap_table(preset);
+	for (i=0;i<mt->n_pool;i++) {
+		if (mt->pool[i].curve) used[mt->pool[i].curve-1]=1;
+	}
+	for (i=0;i<MAX_MIDI_CURVES;i++) preset->curves[i].used=used[i];
+}
+
+//Get a curve LUT, sharing identical ones => Return index+1 (0 if error)
+int alloc_midi_curve(struct mf_preset_st *preset, int curve, uint8_t val_min, uint8_t val_max, uint8_t *lut) {
+	uint8_t buffer[128];
+	int i;
+	if (curve<MIDI_CURVE_LINEAR || curve>MIDI_CURVE_CUSTOM || (curve==MIDI_CURVE_CUSTOM && !lut)) {
+		fprintf (stderr, "ZynMidiRouter: MIDI curve (%d) is not valid!\n",curve);
+		return 0;
+	}
+	if (curve==MIDI_CURVE_CUSTOM) {
+		for (i=0;i<128;i++) buffer[i]=lut[i] & 0x7F;
+		val_min=val_max=0;
+	}
+	else {
+		if (val_min>127 || val_max>127) {
+			fprintf (stderr, "ZynMidiRouter: MIDI curve range (%d-%d) is out of range!\n",val_min,val_max);
+			return 0;
+		}
+		compile_midi_curve(buffer, curve, val_min, val_max);
+	}
+	for (i=0;i<MAX_MIDI_CURVES;i++) {
+		struct mf_curve_st *c=preset->curves+i;
+		if (c->used && c->type==curve && c->val_min==val_min && c->val_max==val_max && !memcmp(preset->curve_luts[i], buffer, 128)) return i+1;
+	}
+	for (i=0;i<MAX_MIDI_CURVES && preset->curves[i].used;i++);
+	if (i>=MAX_MIDI_CURVES) {
+		gc_midi_curves(preset);
+		for (i=0;i<MAX_MIDI_CURVES && preset->curves[i].used;i++);
+		if (i>=MAX_MIDI_CURVES) {
+			fprintf (stderr, "ZynMidiRouter: Too many MIDI curves!\n");
+			return 0;
+		}
+	}
+	memcpy(preset->curve_luts[i], buffer, 128);
+	compile_midi_curve_inverse(preset->curve_inv_luts[i], buffer);
+	preset->curves[i].type=curve;
+	preset->curves[i].val_min=val_min;
+	preset->curves[i].val_max=val_max;
+	preset->curves[i].used=1;
+	__sync_synchronize();
+	return i+1;
+}
+
+int set_midi_filter_event_curve_any(enum midi_event_type_enum type_from, uint8_t chan_from, uint8_t num_from, int curve, uint8_t val_min, uint8_t val_max, uint8_t *lut) {
+	struct midi_event_st ev_from={ .type=type_from, .chan=chan_from, .num=num_from };
+	if (!validate_midi_event(&ev_from)) return 0;
+	struct mf_preset_st *preset=midi_filter.preset;
+	int ic=alloc_midi_curve(preset, curve, val_min, val_max, lut);
+	if (!ic) return 0;
+	preset->event_map[type_from & 0x7][chan_from][num_from].curve=ic;
+	return 1;
+}
+
+int set_midi_filter_event_curve(enum midi_event_type_enum type_from, uint8_t chan_from, uint8_t num_from, int curve, uint8_t val_min, uint8_t val_max) {
+	return set_midi_filter_event_curve_any(type_from, chan_from, num_from, curve, val_min, val_max, NULL);
+}
+
+int set_midi_filter_event_curve_lut(enum midi_event_type_enum type_from, uint8_t chan_from, uint8_t num_from, uint8_t *lut) {
+	return set_midi_filter_event_curve_any(type_from, chan_from, num_from, MIDI_CURVE_CUSTOM, 0, 0, lut);
+}
+
+int del_midi_filter_event_curve(enum midi_event_type_enum type_from, uint8_t chan_from, uint8_t num_from) {
+	struct midi_event_st ev_from={ .type=type_from, .chan=chan_from, .num=num_from };
+	if (!validate_midi_event(&ev_from)) return 0;
+	midi_filter.preset->event_map[type_from & 0x7][chan_from][num_from].curve=0;
+	return 1;
+}
+
+uint8_t *get_midi_filter_event_curve_lut(enum midi_event_type_enum type_from, uint8_t chan_from, uint8_t num_from) {
+	struct midi_event_st ev_from={ .type=type_from, .chan=chan_from, .num=num_from };
+	if (!validate_midi_event(&ev_from)) return NULL;
+	int ic=midi_filter.preset->event_map[type_from & 0x7][chan_from][num_from].curve;
+	if (!ic) return NULL;
+	return midi_filter.preset->curve_luts[ic-1];
+}
+
+int set_midi_filter_event_multimap_curve(enum midi_event_type_enum type_from, uint8_t chan_from, uint8_t num_from, int i_target, int curve, uint8_t *lut) {
+	struct midi_event_st ev_from={ .type=type_from, .chan=chan_from, .num=num_from };
+	if (!validate_midi_event(&ev_from)) return 0;
+	struct mf_preset_st *preset=midi_filter.preset;
+	int im=preset->event_map[type_from & 0x7][chan_from][num_from].multimap-1;
+	struct mf_multimap_table_st *mt=get_multimap_table(preset);
+	if (im<0 || i_target<0 || i_target>=mt->multimaps[im].n_targets) {
+		fprintf (stderr, "ZynMidiRouter: MIDI multimap target (%d) doesn't exist!\n",i_target);
+		return 0;
+	}
+	struct mf_target_st *target=mt->pool+mt->multimaps[im].first+i_target;
+	//Linear uses the default scaling
+	int ic=0;
+	if (curve!=MIDI_CURVE_LINEAR) {
+		ic=alloc_midi_curve(preset, curve, target->val_min, target->val_max, lut);
+		if (!ic) return 0;
+	}
+	mt=edit_multimap_table(preset, 0);
+	mt->pool[mt->multimaps[im].first+i_target].curve=ic;
+	publish_multimap_table(preset, mt);
+	return 1;
+}
+
+//Keyboard zones
+
+void compile_midi_zones(struct mf_preset_st *preset, struct mf_zone_st *zones) {
+	int ib=preset->zone_table ? 0 : 1;
+	struct mf_zone_table_st *zt=preset->zone_tables+ib;
+	int i,j,k;
+	memmove(zt->zones, zones, sizeof(zt->zones));
+	memset(zt->note_mask, 0, sizeof(zt->note_mask));
+	memset(zt->vel_mask, 0, sizeof(zt->vel_mask));
+	memset(zt->chan_mask, 0, sizeof(zt->chan_mask));
+	for (i=0;i<MAX_MIDI_ZONES;i++) {
+		struct mf_zone_st *zone=zt->zones+i;
+		if (!zone->enabled) continue;
+		for (k=zone->note_min;k<=zone->note_max;k++) zt->note_mask[zone->chan_from][k]|=(1<<i);
+		for (k=zone->vel_min;k<=zone->vel_max;k++) zt->vel_mask[k]|=(1<<i);
+		//Layered zones with the same target channel get channel events only once
+		for (j=0;j<i;j++) {
+			if ((zt->chan_mask[zone->chan_from] & (1<<j)) && zt->zones[j].chan_to==zone->chan_to) break;
+		}
+		if (j==i) zt->chan_mask[zone->chan_from]|=(1<<i);
+	}
+	__atomic_store_n(&preset->zone_table, ib, __ATOMIC_RELEASE);
+	//The old table is rewritten by the next change => wait until the RT thread can't be using it
+	wait_midi_cycle();
+}
+
+int set_midi_filter_zone(int iz, uint8_t chan_from, uint8_t note_min, uint8_t note_max, uint8_t vel_min, uint8_t vel_max, uint8_t chan_to, int transpose) {
+	if (iz<0 || iz>=MAX_MIDI_ZONES) {
+		fprintf (stderr, "ZynMidiRouter: MIDI zone index (%d) is out of range!\n",iz);
+		return 0;
+	}
+	if (chan_from>15 || chan_to>15) {
+		fprintf (stderr, "ZynMidiRouter: MIDI zone channel (%d => %d) is out of range!\n",chan_from,chan_to);
+		return 0;
+	}
+	if (note_min>note_max || note_max>127 || vel_min>vel_max || vel_max>127 || transpose<-127 || transpose>127) {
+		fprintf (stderr, "ZynMidiRouter: MIDI zone (%d) has a bad range!\n",iz);
+		return 0;
+	}
+	struct mf_preset_st *preset=midi_filter.preset;
+	struct mf_zone_st zones[MAX_MIDI_ZONES];
+	memcpy(zones, preset->zone_tables[preset->zone_table].zones, sizeof(zones));
+	zones[iz].enabled=1;
+	zones[iz].chan_from=chan_from;
+	zones[iz].note_min=note_min;
+	zones[iz].note_max=note_max;
+	zones[iz].vel_min=vel_min;
+	zones[iz].vel_max=vel_max;
+	zones[iz].chan_to=chan_to;
+	zones[iz].transpose=transpose;
+	compile_midi_zones(preset, zones);
+	return 1;
+}
+
+int get_midi_filter_zone(int iz, struct mf_zone_st *zone) {
+	if (iz<0 || iz>=MAX_MIDI_ZONES) return 0;
+	struct mf_preset_st *preset=midi_filter.preset;
+	*zone=preset->zone_tables[preset->zone_table].zones[iz];
+	return zone->enabled;
+}
+
+int del_midi_filter_zone(int iz) {
+	if (iz<0 || iz>=MAX_MIDI_ZONES) {
+		fprintf (stderr, "ZynMidiRouter: MIDI zone index (%d) is out of range!\n",iz);
+		return 0;
+	}
+	struct mf_preset_st *preset=midi_filter.preset;
+	struct mf_zone_st zones[MAX_MIDI_ZONES];
+	memcpy(zones, preset->zone_tables[preset->zone_table].zones, sizeof(zones));
+	zones[iz].enabled=0;
+	compile_midi_zones(preset, zones);
+	return 1;
+}
+
+//Disabled zones keep their target => held notes can be released
+void reset_midi_filter_zones() {
+	struct mf_preset_st *preset=midi_filter.preset;
+	struct mf_zone_st zones[MAX_MIDI_ZONES];
+	int i;
+	memcpy(zones, preset->zone_tables[preset->zone_table].zones, sizeof(zones));
+	for (i=0;i<MAX_MIDI_ZONES;i++) zones[i].enabled=0;
+	compile_midi_zones(preset, zones);
+}
+
+//High-resolution controllers
+
+int set_midi_filter_hires_mode(uint8_t chan, uint8_t mode) {
+	if (mode & ~(MIDI_HIRES_CC14 | MIDI_HIRES_NRPN)) {
+		fprintf (stderr, "ZynMidiRouter: Bad high-resolution controller mode (%d)\n",mode);
+		return 0;
+	}
+	if (chan==0xFF) {
+		int i;
+		for (i=0;i<16;i++) midi_filter.hires_mode[i]=mode;
+		return 1;
+	}
+	if (chan>15) {
+		fprintf (stderr, "ZynMidiRouter: MIDI channel (%d) is out of range!\n",chan);
+		return 0;
+	}
+	midi_filter.hires_mode[chan]=mode;
+	return 1;
+}
+
+int get_midi_filter_hires_mode(uint8_t chan) {
+	if (chan>15) return 0;
+	return midi_filter.hires_mode[chan];
+}
+
+int get_midi_filter_hires_ctrl_val(uint8_t chan, uint8_t num) {
+	if (chan>15 || num>31) return -1;
+	return midi_filter.hires[chan].ctrl_val[num];
+}
+
+int get_midi_filter_hires_param(uint8_t chan, int *type, int *num) {
+	if (chan>15) return -1;
+	struct mf_hires_st *hr=midi_filter.hires+chan;
+	if (type) *type=hr->param_type;
+	if (num) *num=hr->param_num;
+	if (hr->param_type==MIDI_HIRES_PARAM_NONE) return -1;
+	return hr->param_val;
+}
+
+//Velocity curves
+
+int set_midi_filter_velocity_lut(uint8_t chan, int vtype, uint8_t *lut) {
+	if (vtype!=MIDI_VELOCITY_NOTE_ON && vtype!=MIDI_VELOCITY_NOTE_OFF) {
+		fprintf (stderr, "ZynMidiRouter: Bad velocity curve type (%d)\n",vtype);
+		return 0;
+	}
+	if (chan==0xFF) {
+		int i;
+		for (i=0;i<16;i++) {
+			if (!set_midi_filter_velocity_lut(i, vtype, lut)) return 0;
+		}
+		return 1;
+	}
+	if (chan>15) {
+		fprintf (stderr, "ZynMidiRouter: MIDI channel (%d) is out of range!\n",chan);
+		return 0;
+	}
+	struct mf_velocity_curve_st *vc=&midi_filter.velocity_curve[chan][vtype];
+	//Fill the buffer not used by the RT thread, then publish it
+	int ib=vc->active==0 ? 1 : 0;
+	int i;
+	for (i=0;i<128;i++) {
+		uint8_t v=lut[i] & 0x7F;
+		if (vtype==MIDI_VELOCITY_NOTE_ON) {
+			if (i==0) v=0;
+			else if (v==0) v=1;
+		}
+		vc->lut[ib][i]=v;
+	}
+	__atomic_store_n(&vc->active, ib, __ATOMIC_RELEASE);
+	return 1;
+}
+
+int set_midi_filter_velocity_curve(uint8_t chan, int vtype, int curve, uint8_t val_min, uint8_t val_max) {
+	uint8_t lut[128];
+	if (curve!=MIDI_CURVE_LINEAR && curve!=MIDI_CURVE_LOG && curve!=MIDI_CURVE_EXP) {
+		fprintf (stderr, "ZynMidiRouter: Bad velocity curve (%d)\n",curve);
+		return 0;
+	}
+	compile_midi_curve(lut, curve, val_min, val_max);
+	return set_midi_filter_velocity_lut(chan, vtype, lut);
+}
+
+uint8_t *get_midi_filter_velocity_lut(uint8_t chan, int vtype) {
+	if (chan>15 || (vtype!=MIDI_VELOCITY_NOTE_ON && vtype!=MIDI_VELOCITY_NOTE_OFF)) return NULL;
+	struct mf_velocity_curve_st *vc=&midi_filter.velocity_curve[chan][vtype];
+	int ib=__atomic_load_n(&vc->active, __ATOMIC_ACQUIRE);
+	if (ib<0) return NULL;
+	return vc->lut[ib];
+}
+
+void reset_midi_filter_velocity_curve(uint8_t chan, int vtype) {
+	if (vtype!=MIDI_VELOCITY_NOTE_ON && vtype!=MIDI_VELOCITY_NOTE_OFF) return;
+	if (chan==0xFF) {
+		int i;
+		for (i=0;i<16;i++) reset_midi_filter_velocity_curve(i, vtype);
+		return;
+	}
+	if (chan>15) return;
+	__atomic_store_n(&midi_filter.velocity_curve[chan][vtype].active, -1, __ATOMIC_RELEASE);
 }
 
 //Simple CC mapping
@@ -364,6 +1051,10 @@ uint8_t get_midi_filter_cc_map(uint8_t chan_from, uint8_t cc_from) {
 	return ev->num;
 }
 
+int set_midi_filter_cc_curve(uint8_t chan, uint8_t cc, int curve, uint8_t val_min, uint8_t val_max) {
+	return set_midi_filter_event_curve(CTRL_CHANGE, chan, cc, curve, val_min, val_max);
+}
+
 void del_midi_filter_cc_map(uint8_t chan_from, uint8_t cc_from) {
 	del_midi_filter_event_map(CTRL_CHANGE,chan_from,cc_from);
 }
@@ -387,6 +1078,49 @@ void set_midi_ctrl_automode(int mcam) {
 	midi_ctrl_automode=mcam;
 }
 
+//MIDI Controller Encodings
+
+void init_midi_ctrl_enc_delta() {
+	int v;
+	memset(midi_ctrl_enc_delta, 0, sizeof(midi_ctrl_enc_delta));
+	for (v=0;v<128;v++) {
+		midi_ctrl_enc_delta[MIDI_CTRL_ENC_OFFSET][v]=v-64;
+		midi_ctrl_enc_delta[MIDI_CTRL_ENC_TWOS][v]=(v<64) ? v : v-128;
+		midi_ctrl_enc_delta[MIDI_CTRL_ENC_SIGNMAG][v]=(v & 0x40) ? -(v & 0x3F) : v;
+		midi_ctrl_enc_delta[MIDI_CTRL_ENC_INCDEC][v]=(v==0) ? 0 : ((v<64) ? 1 : -1);
+	}
+}
+
+int set_midi_filter_ctrl_encoding(uint8_t chan, uint8_t num, int enc, int step) {
+	if (enc<0 || enc>=MIDI_CTRL_ENC_NUM) {
+		fprintf (stderr, "ZynMidiRouter: Bad controller encoding (%d)\n",enc);
+		return 0;
+	}
+	if (step<0 || step>16383) {
+		fprintf (stderr, "ZynMidiRouter: Bad controller encoding step (%d)\n",step);
+		return 0;
+	}
+	if ((chan>15 && chan!=0xFF) || (num>127 && num!=0xFF)) {
+		fprintf (stderr, "ZynMidiRouter: MIDI controller (%d, %d) is out of range!\n",chan,num);
+		return 0;
+	}
+	int i,j;
+	for (i=0;i<16;i++) {
+		if (chan!=0xFF && chan!=i) continue;
+		for (j=0;j<128;j++) {
+			if (num!=0xFF && num!=j) continue;
+			midi_filter.ctrl_enc_step[i][j]=step ? step : MIDI_CTRL_ENC_STEP;
+			midi_filter.ctrl_enc[i][j]=enc;
+		}
+	}
+	return 1;
+}
+
+int get_midi_filter_ctrl_encoding(uint8_t chan, uint8_t num) {
+	if (chan>15 || num>127) return -1;
+	return midi_filter.ctrl_enc[chan][num];
+}
+
 
 //-----------------------------------------------------------------------------
 // Swap CC mapping => GRAPH THEORY
@@ -548,6 +1282,135 @@ uint8_t get_midi_filter_cc_swap(uint8_t chan, uint8_t num) {
 	else return arrow.num_from;
 }
 
+//-----------------------------------------------------------------------------
+// MIDI Router Presets
+//-----------------------------------------------------------------------------
+//	+ The active preset is edited in place by the MIDI filter functions
+//	+ The RT thread swaps the active preset pointer at the start of a cycle
+//	+ Routing (zmip => zmop forwarding) is saved/restored on every swap
+//-----------------------------------------------------------------------------
+
+//Copy the active preset to all the preset slots
+int init_midi_presets() {
+	int i;
+	for (i=0;i<MAX_NUM_MIDI_PRESETS;i++) {
+		if (midi_presets+i!=midi_filter.preset) store_midi_preset(i);
+	}
+	// lock the presets into memory, so the RT thread doesn't page-fault when swapping
+	if (mlock(midi_presets, sizeof(midi_presets))) {
+		fprintf (stderr, "ZynMidiRouter: Can't lock memory for MIDI presets.\n");
+	}
+	return 1;
+}
+
+//Copy the active preset, including current routing, to a preset slot
+int store_midi_preset(int i) {
+	if (i<0 || i>=MAX_NUM_MIDI_PRESETS) {
+		fprintf (stderr, "ZynMidiRouter: MIDI preset index (%d) is out of range!\n",i);
+		return 0;
+	}
+	struct mf_preset_st *preset=midi_presets+i;
+	if (preset==midi_filter.preset || i==midi_preset_pending) {
+		fprintf (stderr, "ZynMidiRouter: MIDI preset (%d) is active!\n",i);
+		return 0;
+	}
+	//Held notes are released through the preset they were played with
+	int j,k;
+	for (j=0;j<16;j++) {
+		for (k=0;k<128;k++) {
+			if (midi_filter.note_preset[j][k]==i) {
+				fprintf (stderr, "ZynMidiRouter: MIDI preset (%d) has held notes!\n",i);
+				return 0;
+			}
+		}
+	}
+	//A note-off could be releasing the last one right now
+	wait_midi_cycle();
+	memcpy(preset, midi_filter.preset, sizeof(struct mf_preset_st));
+	for (j=0;j<MAX_NUM_ZMIPS;j++) {
+		memcpy(preset->fwd_zmops[j], zmips[j].fwd_zmops, sizeof(zmips[j].fwd_zmops));
+	}
+	return 1;
+}
+
+//Request a preset switch. It will be done by the RT thread at the start of next cycle.
+int select_midi_preset(int i) {
+	if (i<0 || i>=MAX_NUM_MIDI_PRESETS) {
+		fprintf (stderr, "ZynMidiRouter: MIDI preset index (%d) is out of range!\n",i);
+		return 0;
+	}
+	midi_preset_pending=i;
+	return 1;
+}
+
+int get_midi_preset() {
+	return midi_filter.preset-midi_presets;
+}
+
+void set_midi_preset_handoff(int policy) {
+	if (policy!=MIDI_PRESET_HANDOFF_KEEP && policy!=MIDI_PRESET_HANDOFF_ALL_OFF) {
+		fprintf (stderr, "ZynMidiRouter: MIDI preset hand-off policy (%d) is not valid!\n",policy);
+		return;
+	}
+	midi_preset_handoff=policy;
+}
+
+int get_midi_preset_handoff() {
+	return midi_preset_handoff;
+}
+
+void set_midi_preset_trigger(enum midi_event_type_enum type, int chan, uint8_t num) {
+	if (type!=PROG_CHANGE && type!=CTRL_CHANGE && type!=NONE_EVENT) {
+		fprintf (stderr, "ZynMidiRouter: MIDI preset trigger type (%d) is not valid!\n",type);
+		return;
+	}
+	if (chan>15 || chan<-1) {
+		fprintf (stderr, "ZynMidiRouter: MIDI preset trigger channel (%d) is out of range!\n",chan);
+		return;
+	}
+	midi_preset_trigger.type=NONE_EVENT;
+	midi_preset_trigger.chan=chan;
+	midi_preset_trigger.num=num & 0x7F;
+	midi_preset_trigger.type=type;
+}
+
+void reset_midi_preset_trigger() {
+	set_midi_preset_trigger(NONE_EVENT, -1, 0);
+}
+
+//Swap the active preset => Called from RT thread, after clearing the zmop buffers
+void swap_midi_preset() {
+	int i=midi_preset_pending;
+	midi_preset_pending=-1;
+	struct mf_preset_st *preset=midi_presets+i;
+	if (preset==midi_filter.preset) return;
+
+	//Release held notes
+	if (midi_preset_handoff==MIDI_PRESET_HANDOFF_ALL_OFF) {
+		int chan, note, j, ie;
+		uint8_t ev_buffer[3];
+		for (chan=0;chan<16;chan++) {
+			for (note=0;note<128;note++) {
+				if (midi_filter.note_state[chan][note]>0) {
+					ev_buffer[0]=(NOTE_OFF << 4) | chan;
+					ev_buffer[1]=note;
+					ev_buffer[2]=0;
+					ie=midi_arena_add(0, ev_buffer, 3);
+					if (ie>=0) for (j=0;j<ZMOP_CTRL;j++) zmop_push_index(j, ie, chan);
+					midi_filter.note_state[chan][note]=0;
+				}
+			}
+		}
+	}
+
+	//Save routing to the outgoing preset and load routing from the incoming one
+	for (i=0;i<MAX_NUM_ZMIPS;i++) {
+		memcpy(midi_filter.preset->fwd_zmops[i], zmips[i].fwd_zmops, sizeof(zmips[i].fwd_zmops));
+		memcpy(zmips[i].fwd_zmops, preset->fwd_zmops[i], sizeof(zmips[i].fwd_zmops));
+	}
+	midi_filter.preset=preset;
+}
+
 //-----------------------------------------------------------------------------
 // ZynMidi Input/Ouput Port management
 //-----------------------------------------------------------------------------
@@ -557,48 +1420,174 @@ int zmop_init(int iz, char *name, int ch, uint32_t flags) {
 		fprintf (stderr, "ZynMidiRouter: Bad index (%d) initializing ouput port '%s'.\n", iz, name);
 		return 0;
 	}
-	//Create Jack Output Port
-	zmops[iz].jport = jack_port_register(jack_client, name, JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput, 0);
-	if (zmops[iz].jport == NULL) {
-		fprintf (stderr, "ZynMidiRouter: Error creating jack midi output port '%s'.\n", name);
-		return 0;
+	//Create Jack Output Port => Not in offline mode
+	zmops[iz].jport=NULL;
+	if (jack_client) {
+		zmops[iz].jport = jack_port_register(jack_client, name, JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput, 0);
+		if (zmops[iz].jport == NULL) {
+			fprintf (stderr, "ZynMidiRouter: Error creating jack midi output port '%s'.\n", name);
+			return 0;
+		}
 	}
 	//Set init values
-	zmops[iz].n_data=0;
+	zmops[iz].n_events=0;
+	zmops[iz].n_rt_events=0;
+	//Controller & channel ports don't get the realtime lane
+	zmops[iz].rt_mask=(iz==ZMOP_CTRL || ch>=0) ? 0 : MIDI_RT_ALL;
+	memset(zmops[iz].status_mask, 0xFF, sizeof(zmops[iz].status_mask));
 	zmops[iz].midi_channel=ch;
 	zmops[iz].n_connections=0;
 	zmops[iz].flags=flags;
 	return 1;
 }
 
+//-----------------------------------------------------------------------------
+// Per-cycle Event Arena
+//-----------------------------------------------------------------------------
+
+int init_midi_arena() {
+	midi_arena.n_events=0;
+	midi_arena.overflows=0;
+	if (mlock(&midi_arena, sizeof(midi_arena))) {
+		fprintf (stderr, "ZynMidiRouter: Can't lock memory for MIDI event arena.\n");
+	}
+	if (mlock(zmops, sizeof(zmops)) || mlock(zmop_sort_buffer, sizeof(zmop_sort_buffer))) {
+		fprintf (stderr, "ZynMidiRouter: Can't lock memory for output ports.\n");
+	}
+	return 1;
+}
+
+int midi_arena_add(jack_nframes_t time, uint8_t *data, int size) {
+	if (midi_arena.n_events>=MIDI_ARENA_SIZE || size<1 || size>3) {
+		midi_arena.overflows++;
+		return -1;
+	}
+	struct zynmidi_event_st *ev=midi_arena.events+midi_arena.n_events;
+	ev->time=time;
+	ev->size=size;
+	memcpy(ev->data, data, size);
+	return midi_arena.n_events++;
+}
+
+//-----------------------------------------------------------------------------
+// ZynMidi Output Ports
+//-----------------------------------------------------------------------------
+
+//Push event, adding it to the arena => When fanning-out, add once & use zmop_push_index
 int zmop_push_event(int iz, jack_midi_event_t ev, int ch) {
+	int ie=midi_arena_add(ev.time, ev.buffer, ev.size);
+	if (ie<0) return 0;
+	return zmop_push_index(iz, ie, ch);
+}
+
+//Push a reference to an arena event
+int zmop_push_index(int iz, int ie, int ch) {
 	if (iz<0 || iz>=MAX_NUM_ZMOPS) {
 		fprintf (stderr, "ZynMidiRouter: Bad output port index (%d).\n", iz);
 		return -1;
 	}
 	struct zmop_st *zmop=zmops+iz;
-	if (zmop->midi_channel<0 || zmop->midi_channel==ch) {
-		memcpy(zmop->data+zmop->n_data, ev.buffer, ev.size);
-		zmop->n_data+=ev.size;
-		return ev.size;
+	struct zynmidi_event_st *ev=midi_arena.events+ie;
+	if (!MIDI_STATUS_ACCEPTED(zmop->status_mask, ev->data[0])) return 0;
+	//Channel zmops only get channel messages
+	if (zmop->midi_channel<0 || (zmop->midi_channel==ch && ev->data[0]<SYSTEM_EXCLUSIVE)) {
+		if (zmop->n_events>=ZMOP_MAX_EVENTS) return 0;
+		zmop->events[zmop->n_events++]=ie;
+		return ev->size;
 	}
 	return 0;
 }
 
+//Push a reference to an arena event into the realtime lane
+int zmop_push_rt_index(int iz, int ie) {
+	struct zmop_st *zmop=zmops+iz;
+	if (!MIDI_STATUS_ACCEPTED(zmop->status_mask, midi_arena.events[ie].data[0])) return 0;
+	if (zmop->n_rt_events>=ZMOP_MAX_RT_EVENTS) return 0;
+	zmop->rt_events[zmop->n_rt_events++]=ie;
+	return midi_arena.events[ie].size;
+}
+
+//Build channel demultiplexing tables => Call after initializing zmops
+int zmops_init_demux() {
+	int i;
+	for (i=0;i<16;i++) zmop_chan[i]=-1;
+	n_zmops_nochan=0;
+	for (i=0;i<MAX_NUM_ZMOPS;i++) {
+		if (zmops[i].midi_channel>=0 && zmops[i].midi_channel<16) zmop_chan[zmops[i].midi_channel]=i;
+		else zmops_nochan[n_zmops_nochan++]=i;
+	}
+	return 1;
+}
+
 int zmop_clear_data(int iz) {
 	if (iz<0 || iz>=MAX_NUM_ZMOPS) {
 		fprintf (stderr, "ZynMidiRouter: Bad output port index (%d).\n", iz);
 		return 0;
 	}
-	zmops[iz].n_data=0;
+	zmops[iz].n_events=0;
+	zmops[iz].n_rt_events=0;
 	return 1;
 }
 
 int zmops_clear_data() {
 	int i;
 	for (i=0;i<MAX_NUM_ZMOPS;i++) {
-		zmops[i].n_data=0;
+		zmops[i].n_events=0;
+		zmops[i].n_rt_events=0;
+	}
+	return 1;
+}
+
+int zmop_set_rt_mask(int iz, uint8_t mask) {
+	if (iz<0 || iz>=MAX_NUM_ZMOPS) {
+		fprintf (stderr, "ZynMidiRouter: Bad output port index (%d).\n", iz);
+		return 0;
+	}
+	zmops[iz].rt_mask=mask & MIDI_RT_ALL;
+	return 1;
+}
+
+int zmop_get_rt_mask(int iz) {
+	if (iz<0 || iz>=MAX_NUM_ZMOPS) {
+		fprintf (stderr, "ZynMidiRouter: Bad output port index (%d).\n", iz);
+		return -1;
+	}
+	return zmops[iz].rt_mask;
+}
+
+//Accept/reject a range of status bytes
+void set_status_mask_range(uint32_t *mask, uint8_t status_from, uint8_t status_to, int accept) {
+	int i;
+	for (i=status_from;i<=status_to;i++) {
+		if (accept) mask[i >> 5]|=(1U << (i & 0x1F));
+		else mask[i >> 5]&=~(1U << (i & 0x1F));
+	}
+}
+
+int zmop_set_status_mask(int iz, uint32_t *mask) {
+	if (iz<0 || iz>=MAX_NUM_ZMOPS) {
+		fprintf (stderr, "ZynMidiRouter: Bad output port index (%d).\n", iz);
+		return 0;
+	}
+	memcpy(zmops[iz].status_mask, mask, sizeof(zmops[iz].status_mask));
+	return 1;
+}
+
+int zmop_get_status_mask(int iz, uint32_t *mask) {
+	if (iz<0 || iz>=MAX_NUM_ZMOPS) {
+		fprintf (stderr, "ZynMidiRouter: Bad output port index (%d).\n", iz);
+		return 0;
 	}
+	memcpy(mask, zmops[iz].status_mask, sizeof(zmops[iz].status_mask));
+	return 1;
+}
+
+int zmop_set_status_accept(int iz, uint8_t status_from, uint8_t status_to, int accept) {
+	if (iz<0 || iz>=MAX_NUM_ZMOPS) {
+		fprintf (stderr, "ZynMidiRouter: Bad output port index (%d).\n", iz);
+		return 0;
+	}
+	set_status_mask_range(zmops[iz].status_mask, status_from, status_to, accept);
 	return 1;
 }
 
@@ -624,23 +1613,94 @@ int zmip_init(int iz, char *name, uint32_t flags) {
 		fprintf (stderr, "ZynMidiRouter: Bad index (%d) initializing input port '%s'.\n", iz, name);
 		return 0;
 	}
-	//Create Jack Output Port
-	zmips[iz].jport = jack_port_register(jack_client, name, JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
-	if (zmips[iz].jport == NULL) {
-		fprintf (stderr, "ZynMidiRouter: Error creating jack midi input port '%s'.\n", name);
-		return 0;
+	//Create Jack Input Port => Not in offline mode
+	zmips[iz].jport=NULL;
+	if (jack_client) {
+		zmips[iz].jport = jack_port_register(jack_client, name, JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
+		if (zmips[iz].jport == NULL) {
+			fprintf (stderr, "ZynMidiRouter: Error creating jack midi input port '%s'.\n", name);
+			return 0;
+		}
 	}
 	//Clear zmop forwarding flags
 	int i;
 	for (i=0;i<MAX_NUM_ZMOPS;i++)
 		zmips[iz].fwd_zmops[i]=0;
 
-	//Set flag init value
+	//Set flag init value & processing function
 	zmips[iz].flags=flags;
+	zmip_select_process(iz);
+	memset(zmips[iz].status_mask, 0xFF, sizeof(zmips[iz].status_mask));
+
+	//Clear injected events
+	zmips[iz].n_inject=0;
 
 	return 1;
 }
 
+//Inject an event into a zmip for the current cycle => Call from RT thread, before zmips processing.
+//Events are kept in time order, after any injected event with the same time.
+int zmip_inject_event(int iz, jack_nframes_t time, uint8_t *data, int size) {
+	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
+		fprintf (stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+		return 0;
+	}
+	struct zmip_st *zmip=zmips+iz;
+	if (zmip->n_inject>=ZMIP_INJECT_SIZE || size<1 || size>3) return 0;
+	int i=zmip->n_inject++;
+	while (i>0 && zmip->inject[i-1].time>time) {
+		zmip->inject[i]=zmip->inject[i-1];
+		i--;
+	}
+	struct zynmidi_event_st *ev=zmip->inject+i;
+	ev->time=time;
+	ev->size=size;
+	memcpy(ev->data, data, size);
+	return 1;
+}
+
+//Get next input event without consuming it
+int zmip_peek_event(struct zmip_st *zmip, void *port_buffer, jack_midi_event_t *ev) {
+	jack_midi_event_t jev;
+	int has_jev=(port_buffer!=NULL && jack_midi_event_get(&jev, port_buffer, zmip->i_jack)==0);
+	if (zmip->i_inject<zmip->n_inject) {
+		struct zynmidi_event_st *iev=zmip->inject+zmip->i_inject;
+		if (!has_jev || iev->time<jev.time) {
+			ev->time=iev->time;
+			ev->size=iev->size;
+			ev->buffer=iev->data;
+			return 0;
+		}
+	}
+	if (has_jev) {
+		*ev=jev;
+		return 0;
+	}
+	return -1;
+}
+
+//Get next input event, from jack input or injected events, ordered by time
+int zmip_get_event(struct zmip_st *zmip, void *port_buffer, jack_midi_event_t *ev) {
+	jack_midi_event_t jev;
+	int has_jev=(port_buffer!=NULL && jack_midi_event_get(&jev, port_buffer, zmip->i_jack)==0);
+	if (zmip->i_inject<zmip->n_inject) {
+		struct zynmidi_event_st *iev=zmip->inject+zmip->i_inject;
+		if (!has_jev || iev->time<jev.time) {
+			ev->time=iev->time;
+			ev->size=iev->size;
+			ev->buffer=iev->data;
+			zmip->i_inject++;
+			return 0;
+		}
+	}
+	if (has_jev) {
+		*ev=jev;
+		zmip->i_jack++;
+		return 0;
+	}
+	return -1;
+}
+
 int zmip_set_forward(int izmip, int izmop, int fwd) {
 	if (izmip<0 || izmip>=MAX_NUM_ZMIPS) {
 		fprintf (stderr, "ZynMidiRouter: Bad input port index (%d).\n", izmip);
@@ -660,6 +1720,7 @@ int zmip_set_flags(int iz, uint32_t flags) {
 		return 0;
 	}
 	zmips[iz].flags=flags;
+	zmip_select_process(iz);
 	return 1;
 }
 
@@ -671,6 +1732,33 @@ int zmip_has_flags(int iz, uint32_t flags) {
 	return (zmips[iz].flags & flags)==flags;
 }
 
+int zmip_set_status_mask(int iz, uint32_t *mask) {
+	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
+		fprintf (stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+		return 0;
+	}
+	memcpy(zmips[iz].status_mask, mask, sizeof(zmips[iz].status_mask));
+	return 1;
+}
+
+int zmip_get_status_mask(int iz, uint32_t *mask) {
+	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
+		fprintf (stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+		return 0;
+	}
+	memcpy(mask, zmips[iz].status_mask, sizeof(zmips[iz].status_mask));
+	return 1;
+}
+
+int zmip_set_status_accept(int iz, uint8_t status_from, uint8_t status_to, int accept) {
+	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
+		fprintf (stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+		return 0;
+	}
+	set_status_mask_range(zmips[iz].status_mask, status_from, status_to, accept);
+	return 1;
+}
+
 //-----------------------------------------------------------------------------
 // Jack MIDI processing
 //-----------------------------------------------------------------------------
@@ -680,7 +1768,30 @@ int init_jack_midi(char *name) {
 		fprintf (stderr, "ZynMidiRouter: Error connecting with jack server.\n");
 		return 0;
 	}
+	jack_sample_rate=jack_get_sample_rate(jack_client);
+	jack_buffer_size=jack_get_buffer_size(jack_client);
 
+	if (!init_zynmidi_ports()) return 0;
+
+	//Init Jack Process
+	jack_set_process_callback(jack_client, jack_process, 0);
+	if (jack_activate(jack_client)) {
+		fprintf (stderr, "ZynMidiRouter: Error activating jack client.\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+int end_jack_midi() {
+	//jack_client_close returns 0 on success
+	if (jack_client && jack_client_close(jack_client)) return 0;
+	jack_client=NULL;
+	return 1;
+}
+
+//Init ports, default routing & internal ring-buffers
+int init_zynmidi_ports() {
 	int i;
 
 	//Init Output Ports
@@ -694,6 +1805,8 @@ int init_jack_midi(char *name) {
 		sprintf(port_name,"ch%d_out",i);
 		if (!zmop_init(ZMOP_CH0+i,port_name,i,ZMOP_MAIN_FLAGS)) return 0;
 	}
+	zmops_init_demux();
+	init_midi_arena();
 
 	//Init Input Ports
 	if (!zmip_init(ZMIP_MAIN,"main_in",ZMIP_MAIN_FLAGS)) return 0;
@@ -716,6 +1829,9 @@ int init_jack_midi(char *name) {
 	// ZMOP_CTRL is not forwarded from any input port, only receive feedback from Zynthian UI
 	// ZMIP_CTRL is not routed to any output port, only captured by Zynthian UI
 
+	//Init MIDI presets from the default filter & routing
+	if (!init_midi_presets()) return 0;
+
 	//Init Ring-Buffers
 	jack_ring_output_buffer = jack_ringbuffer_create(JACK_MIDI_BUFFER_SIZE);
 	// lock the buffer into memory, this is *NOT* realtime safe, do it before using the buffer!
@@ -730,20 +1846,9 @@ int init_jack_midi(char *name) {
 		return 0;
 	}
 
-	//Init Jack Process
-	jack_set_process_callback(jack_client, jack_process, 0);
-	if (jack_activate(jack_client)) {
-		fprintf (stderr, "ZynMidiRouter: Error activating jack client.\n");
-		return 0;
-	}
-
 	return 1;
 }
 
-int end_jack_midi() {
-	return jack_client_close(jack_client);
-}
-
 
 //-----------------------------------------------------
 // Process ZynMidi Input Port (zmip)
@@ -752,7 +1857,8 @@ int end_jack_midi() {
 
 int current_midi_filter_active_chan;
 
-int jack_process_zmip(int iz, jack_nframes_t nframes) {
+//Processing body, inlined in the variants with constant flags, so the compiler removes the flag tests
+static inline __attribute__((always_inline)) int jack_process_zmip_flags(int iz, jack_nframes_t nframes, const uint32_t flags) {
 	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
 		fprintf (stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
 	}
@@ -764,14 +1870,32 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 	uint8_t event_chan;
 	uint8_t event_num;
 	uint8_t event_val;
+	//UI event => set if captured
 	uint32_t ui_event;
-
-	//Read jackd data buffer
-	void *input_port_buffer = jack_port_get_buffer(zmip->jport, nframes);
-	if (input_port_buffer==NULL) {
-		fprintf (stderr, "ZynMidiRouter: Error allocating jack input port buffer: %d frames\n", nframes);
-		return -1;
+	uint8_t ui_flags=0;
+	uint8_t ui_data[3];
+	//Event bytes as received
+	uint8_t orig[3]={0,0,0};
+	//Controller with an explicit encoding => skip the auto-mode heuristic
+	int ctrl_enc=0;
+	//High-resolution controller => aggregated event (MIDI_HIRES_PARAM_*+1 for NRPN/RPN)
+	uint8_t hr_kind=0;
+	int hr_lsb=-1;
+	uint16_t hr_param=0;
+	jack_midi_data_t hr_buffer[3];
+	jack_midi_event_t hr_ev;
+
+	//Read jackd data buffer => Not in offline mode
+	void *input_port_buffer=NULL;
+	if (zmip->jport) {
+		input_port_buffer = jack_port_get_buffer(zmip->jport, nframes);
+		if (input_port_buffer==NULL) {
+			fprintf (stderr, "ZynMidiRouter: Error allocating jack input port buffer: %d frames\n", nframes);
+			return -1;
+		}
 	}
+	zmip->i_jack=0;
+	zmip->i_inject=0;
 
 	//Process MIDI messages
 
@@ -781,6 +1905,28 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 	xev.buffer=(jack_midi_data_t *)&xev_buffer;
 	int clone_from_chan=-1;
 	int clone_to_chan=-1;
+	//Source value of the clones => restored if a curve was applied
+	uint8_t clone_val=0;
+	int curved=0;
+	struct mf_preset_st *preset=midi_filter.preset;
+	//Preset of the input event & its clones => see preset hand-off
+	struct mf_preset_st *src_preset=midi_filter.preset;
+	//One-to-many mapping => pending target list & source event
+	//Target list is copied when the expansion starts => the table can be republished meanwhile
+	struct mf_target_st *mm_targets=NULL;
+	int mm_n=0;
+	int mm_i=0;
+	int mm_next=0;
+	uint8_t mm_type=0, mm_chan=0, mm_num=0, mm_val=0;
+	jack_midi_data_t mm_buffer[3];
+	//Keyboard zones => pending zones & source event
+	struct mf_zone_table_st *zt=NULL;
+	uint16_t zn_mask=0;
+	int zn_next=0;
+	int zn_src=0;
+	uint8_t zn_type=0, zn_chan=0, zn_num=0, zn_val=0, zn_size=0;
+	jack_midi_data_t zn_orig[3];
+	jack_midi_data_t zn_buffer[3];
 
 	while (1) {
 
@@ -790,8 +1936,39 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 			return -1;
 		}
 
-		//Clone from last event ...
-		if (clone_from_chan>=0 && clone_to_chan>=0 && clone_to_chan<16) {
+		//Next target of a one-to-many mapping ...
+		mm_next=(mm_targets!=NULL);
+		zn_next=0;
+		zn_src=0;
+		if (mm_next) {
+			event_type=mm_type;
+			event_chan=mm_chan;
+			event_num=mm_num;
+			event_val=mm_val;
+		}
+		//Or next zone of a split/layer ...
+		else if (zn_mask) {
+			zn_next=1;
+			event_type=zn_type;
+			event_chan=zn_chan;
+			event_num=zn_num;
+			event_val=zn_val;
+		}
+		//Or clone from last event ...
+		else if (clone_from_chan>=0 && clone_to_chan>=0 && clone_to_chan<16) {
+			//Restore source event if it was expanded by a one-to-many mapping
+			if (ev.buffer==mm_buffer) {
+				mm_buffer[0]=(mm_type << 4) | mm_chan;
+				mm_buffer[1]=mm_num;
+				mm_buffer[2]=mm_val;
+				ev.size=MIDI_STATUS_SIZE(mm_buffer[0]);
+				event_num=mm_num;
+				event_val=mm_val;
+			}
+			else if (curved && ev.size==3) {
+				ev.buffer[2]=event_val=clone_val;
+			}
+			curved=0;
 			event_chan=clone_to_chan;
 			event_type=ev.buffer[0] >> 4;
 			ev.buffer[0]=(event_type << 4) | event_chan;
@@ -800,40 +1977,179 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 		}
 		//Or get next event ...
 		else {
-			if (jack_midi_event_get(&ev, input_port_buffer, i++)!=0) break;
-
-			//Ignore Active Sense & SysEx messages => Is it OK?
-			if (ev.buffer[0]==ACTIVE_SENSE || ev.buffer[0]==SYSTEM_EXCLUSIVE) continue;
+			if (zmip_get_event(zmip, input_port_buffer, &ev)!=0) break;
+			i++;
+
+			//Unwanted status => dropped before any processing (stats, capture & probe included)
+			if (!MIDI_STATUS_ACCEPTED(zmip->status_mask, ev.buffer[0])) continue;
+
+			curved=0;
+			zn_src=1;
+			zynmidi_stats.zmip_events[iz]++;
+
+			//Capture input events
+			if (midi_capture_zmips & (1<<iz)) capture_midi_event(iz, jack_cycle_frame+ev.time, ev.buffer, ev.size);
+
+			//Latency probe marker
+			if (midi_probe.enabled && iz==midi_probe.zmip && ev.buffer[0]==SYSTEM_EXCLUSIVE && midi_probe_receive(&ev)) continue;
+
+			//Save event bytes as received
+			orig[0]=ev.buffer[0];
+			orig[1]=(ev.size>1) ? ev.buffer[1] : 0;
+			orig[2]=(ev.size>2) ? ev.buffer[2] : 0;
+
+			//Decode status byte
+			const struct midi_status_st *status=MIDI_STATUS(ev.buffer[0]);
+
+			//Ignore Active Sense, SysEx messages & stray data bytes => Is it OK?
+			if (status->handler==MIDI_HANDLER_IGNORE || status->size==0 || ev.size<status->size) continue;
+
+			//Realtime lane => clock & transport bypass the filters and keep their frame offset
+			if (status->handler==MIDI_HANDLER_CLOCK || status->handler==MIDI_HANDLER_TRANSPORT) {
+				uint8_t rt_bit=(status->handler==MIDI_HANDLER_CLOCK) ? MIDI_RT_CLOCK : MIDI_RT_TRANSPORT;
+				//Tempo estimation
+				if (rt_bit==MIDI_RT_CLOCK) midi_clock_tick(iz, jack_cycle_frame+ev.time);
+				else midi_clock_transport(iz, ev.buffer[0], jack_cycle_frame+ev.time);
+				int iev=midi_arena_add(ev.time, ev.buffer, 1);
+				if (iev<0) continue;
+				for (j=0;j<n_zmops_nochan;j++) {
+					int izmop=zmops_nochan[j];
+					if (zmip->fwd_zmops[izmop] && zmops[izmop].n_connections>0 && (zmops[izmop].rt_mask & rt_bit)) zmop_push_rt_index(izmop, iev);
+				}
+				if (flags & FLAG_ZMIP_UI) write_zynmidi_ext(zynmidi_frame_to_us(jack_cycle_frame+ev.time), ZYNMIDI_SRC_ZMIP|iz, 0, orig, ev.buffer);
+				continue;
+			}
 
 			//Get event type & chan
-			if (ev.buffer[0]>=SYSTEM_EXCLUSIVE) {
+			if (status->channel) {
+				event_type=ev.buffer[0] >> 4;
+				event_chan=ev.buffer[0] & 0xF;
+			}
+			else {
 				event_type=ev.buffer[0];
 				event_chan=0;
 			}
-			else {
-				event_type=ev.buffer[0] >> 4;
-				event_chan=ev.buffer[0] & 0xF;
+
+			//Get event details depending of event type
+			event_num=status->num_pos ? ev.buffer[status->num_pos] & 0x7F : 0;
+			event_val=status->val_pos ? ev.buffer[status->val_pos] & 0x7F : 0;
+
+			//Preset switching trigger
+			if ((flags & FLAG_ZMIP_PRESET) && midi_preset_trigger.type!=NONE_EVENT && event_type==midi_preset_trigger.type) {
+				int trigger_chan=midi_preset_trigger.chan;
+				if (trigger_chan<0) trigger_chan=midi_filter.master_chan;
+				if (trigger_chan>=0 && event_chan==trigger_chan) {
+					if (event_type==PROG_CHANGE) {
+						if (event_num<MAX_NUM_MIDI_PRESETS) midi_preset_pending=event_num;
+						continue;
+					}
+					else if (event_num==midi_preset_trigger.num) {
+						if (event_val<MAX_NUM_MIDI_PRESETS) midi_preset_pending=event_val;
+						continue;
+					}
+				}
+			}
+
+			//High-resolution controllers => aggregate MSB/LSB pairs & NRPN/RPN sequences
+			hr_kind=0;
+			hr_lsb=-1;
+			if ((flags & FLAG_ZMIP_FILTER) && event_type==CTRL_CHANGE && midi_filter.hires_mode[event_chan]) {
+				struct mf_hires_st *hr=midi_filter.hires+event_chan;
+				uint8_t mode=midi_filter.hires_mode[event_chan];
+				int msb_num=-1;
+				int lsb_num=-1;
+				if ((mode & MIDI_HIRES_NRPN) && event_num>=98 && event_num<=101) {
+					//Parameter number is kept => sent again with every value
+					if (event_num==99 || event_num==101) hr->param_num=event_val << 7;
+					else hr->param_num=(hr->param_num & 0x3F80) | event_val;
+					hr->param_type=(event_num>=100) ? MIDI_HIRES_PARAM_RPN : MIDI_HIRES_PARAM_NRPN;
+					if (hr->param_type==MIDI_HIRES_PARAM_RPN && hr->param_num==0x3FFF) hr->param_type=MIDI_HIRES_PARAM_NONE;
+					continue;
+				}
+				if ((mode & MIDI_HIRES_NRPN) && hr->param_type!=MIDI_HIRES_PARAM_NONE && (event_num==6 || event_num==38)) {
+					if (event_num==6) msb_num=6;
+					else lsb_num=6;
+					hr_kind=hr->param_type+1;
+					hr_param=hr->param_num;
+				}
+				//Data increment/decrement => step the parameter value (data byte is the step, 0 => 1) & send it as MSB+LSB
+				else if ((mode & MIDI_HIRES_NRPN) && hr->param_type!=MIDI_HIRES_PARAM_NONE && (event_num==96 || event_num==97)) {
+					int step=event_val ? event_val : 1;
+					int v=(int)hr->param_val+(event_num==96 ? step : -step);
+					if (v<0) v=0;
+					else if (v>0x3FFF) v=0x3FFF;
+					hr->param_val=v;
+					hr_kind=hr->param_type+1;
+					hr_param=hr->param_num;
+					hr_lsb=v & 0x7F;
+					event_num=6;
+					event_val=v >> 7;
+					hr_buffer[0]=ev.buffer[0];
+					hr_buffer[1]=event_num;
+					hr_buffer[2]=event_val;
+					ev.buffer=hr_buffer;
+				}
+				//Bank select (0/32) is not aggregated
+				else if ((mode & MIDI_HIRES_CC14) && event_num>0 && event_num<64 && event_num!=32) {
+					if (event_num<32) msb_num=event_num;
+					else lsb_num=event_num-32;
+					hr_kind=MIDI_HIRES_CC14;
+				}
+				uint16_t *val=NULL;
+				if (hr_kind) val=(hr_kind==MIDI_HIRES_CC14) ? hr->ctrl_val+(msb_num>=0 ? msb_num : lsb_num) : &hr->param_val;
+				//MSB => take the LSB if it's the next event
+				if (msb_num>=0) {
+					*val=event_val << 7;
+					if (zmip_peek_event(zmip, input_port_buffer, &hr_ev)==0 && hr_ev.size==3 && hr_ev.buffer[0]==ev.buffer[0] && hr_ev.buffer[1]==msb_num+32) {
+						zmip_get_event(zmip, input_port_buffer, &hr_ev);
+						i++;
+						zynmidi_stats.zmip_events[iz]++;
+						if (midi_capture_zmips & (1<<iz)) capture_midi_event(iz, jack_cycle_frame+hr_ev.time, hr_ev.buffer, hr_ev.size);
+						hr_lsb=hr_ev.buffer[2] & 0x7F;
+						*val|=hr_lsb;
+					}
+				}
+				//LSB alone => refine the last MSB
+				else if (lsb_num>=0) {
+					hr_lsb=event_val;
+					*val=(*val & 0x3F80) | hr_lsb;
+					event_num=lsb_num;
+					event_val=*val >> 7;
+					hr_buffer[0]=ev.buffer[0];
+					hr_buffer[1]=event_num;
+					hr_buffer[2]=event_val;
+					ev.buffer=hr_buffer;
+				}
 			}
 
-			//Get event details depending of event type & size
-			if (event_type==PITCH_BENDING) {
-				event_num=0;
-				event_val=ev.buffer[2] & 0x7F;
-			}
-			else if (event_type==CHAN_PRESS) {
-				event_num=0;
-				event_val=ev.buffer[1] & 0x7F;
-			}
-			else if (ev.size==3) {
-				event_num=ev.buffer[1] & 0x7F;
-				event_val=ev.buffer[2] & 0x7F;
-			}
-			else if (ev.size==2) {
-				event_num=ev.buffer[1] & 0x7F;
-				event_val=0;
-			}
-			else {
-				event_num=event_val=0;
+			//Controller encoding => decode relative values to an accumulated 14-bit value
+			ctrl_enc=0;
+			if (event_type==CTRL_CHANGE && !hr_kind && midi_filter.ctrl_enc[event_chan][event_num]!=MIDI_CTRL_ENC_AUTO) {
+				uint8_t enc=midi_filter.ctrl_enc[event_chan][event_num];
+				uint16_t *acc=&midi_filter.ctrl_enc_val[event_chan][event_num];
+				ctrl_enc=1;
+				if (enc==MIDI_CTRL_ENC_ABSOLUTE) {
+					*acc=event_val << 7;
+				} else {
+					int delta=midi_ctrl_enc_delta[enc][event_val];
+					if (delta==0) continue;
+					//Resync with the value set from other sources => only if the CC is not moved
+					uint8_t last_val=*acc >> 7;
+					if (midi_filter.preset->event_map[CTRL_CHANGE & 0x7][event_chan][event_num].type==THRU_EVENT && (current_midi_filter_active_chan<0 || event_chan==midi_filter.master_chan)) {
+						last_val=midi_filter.last_ctrl_val[event_chan][event_num];
+						if ((*acc >> 7)!=last_val) *acc=last_val << 7;
+					}
+					int val=*acc+delta*midi_filter.ctrl_enc_step[event_chan][event_num];
+					if (val<0) val=0;
+					else if (val>16383) val=16383;
+					*acc=val;
+					//Fine steps => send only when the 7-bit value changes
+					if ((val >> 7)==last_val) continue;
+					hr_buffer[0]=ev.buffer[0];
+					hr_buffer[1]=event_num;
+					hr_buffer[2]=event_val=val >> 7;
+					ev.buffer=hr_buffer;
+				}
 			}
 
 			if (ev.buffer[0]<SYSTEM_EXCLUSIVE && event_chan!=midi_filter.master_chan) {
@@ -842,7 +2158,7 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 					int destiny_chan=current_midi_filter_active_chan;
 
 					// TODO: Exclude if it's a cloned channel ...
-					if (midi_filter.last_active_chan>=0 && !midi_filter.clone[destiny_chan][midi_filter.last_active_chan].enabled) { 
+					if (midi_filter.last_active_chan>=0 && !midi_filter.preset->clone[destiny_chan][midi_filter.last_active_chan].enabled) { 
 						//Manage sustained notes across active channel change (only last change!)
 						if ((event_type==NOTE_OFF || (event_type==NOTE_ON && event_val==0)) && midi_filter.note_state[midi_filter.last_active_chan][event_num]>0) {
 							destiny_chan=midi_filter.last_active_chan;
@@ -860,15 +2176,29 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 							zynmidi_send_ccontrol_change(destiny_chan, 64, midi_filter.last_ctrl_val[midi_filter.last_active_chan][64]);
 						}
 					}
+					if (flags & FLAG_ZMIP_FILTER) midi_filter.active_chan_src=event_chan;
 					ev.buffer[0]=(ev.buffer[0] & 0xF0) | (destiny_chan & 0x0F);
 					event_chan=destiny_chan;
 				}
 			}
 
+			//Preset hand-off => note-off events are cloned, mapped & routed through the preset that routed the note-on
+			src_preset=midi_filter.preset;
+			if (midi_preset_handoff==MIDI_PRESET_HANDOFF_KEEP && (event_type==NOTE_OFF || event_type==NOTE_ON)) {
+				uint8_t *note_preset=&midi_filter.note_preset[event_chan][event_num];
+				if (event_type==NOTE_ON && event_val>0) {
+					*note_preset=src_preset-midi_presets;
+				} else if (*note_preset<MAX_NUM_MIDI_PRESETS) {
+					src_preset=midi_presets+*note_preset;
+					*note_preset=0xFF;
+				}
+			}
+
 			//Is it a clonable event?
-			if ((zmip->flags & FLAG_ZMIP_CLONE) && (event_type==NOTE_OFF || event_type==NOTE_ON || event_type==PITCH_BENDING || event_type==KEY_PRESS || event_type==CHAN_PRESS || event_type==CTRL_CHANGE)) {
+			if ((flags & FLAG_ZMIP_CLONE) && (event_type==NOTE_OFF || event_type==NOTE_ON || event_type==PITCH_BENDING || event_type==KEY_PRESS || event_type==CHAN_PRESS || event_type==CTRL_CHANGE)) {
 				clone_from_chan=event_chan;
 				clone_to_chan=0;
+				clone_val=event_val;
 			}
 			else {
 				clone_from_chan=-1;
@@ -878,7 +2208,7 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 
 		//Check for next clone_to channel ...
 		if (clone_from_chan>=0 && clone_to_chan>=0) {
-			while (clone_to_chan<16 && (!midi_filter.clone[clone_from_chan][clone_to_chan].enabled || (event_type==CTRL_CHANGE && !midi_filter.clone[clone_from_chan][clone_to_chan].cc[event_num]))) {
+			while (clone_to_chan<16 && (!src_preset->clone[clone_from_chan][clone_to_chan].enabled || (event_type==CTRL_CHANGE && !src_preset->clone[clone_from_chan][clone_to_chan].cc[event_num]))) {
 				clone_to_chan++;
 			}
 			//fprintf (stdout, "NEXT CLONE %x => %d, %d\n",event_type, clone_from_chan, clone_to_chan);
@@ -889,20 +2219,123 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 
 		//Capture events for UI: before filtering => [Control-Change for MIDI learning]
 		ui_event=0;
-		if ((zmip->flags & FLAG_ZMIP_UI) && midi_learning_mode && event_type==CTRL_CHANGE) {
-			ui_event=(ev.buffer[0]<<16)|(ev.buffer[1]<<8)|(ev.buffer[2]);
+		if ((flags & FLAG_ZMIP_UI) && midi_learning_mode && event_type==CTRL_CHANGE && !mm_next && !zn_next) {
+			ui_event=1;
+			ui_flags=ZYNMIDI_FLAG_LEARN;
+			memcpy(ui_data, ev.buffer, 3);
+		}
+
+		//Preset of the input event => kept while expanding zones & one-to-many mappings
+		if (!mm_next && !zn_next) preset=src_preset;
+
+		//Keyboard zones => resolve the zones of an input event with a table lookup
+		if (zn_src && (flags & FLAG_ZMIP_FILTER) && event_type>=NOTE_OFF && event_type<=PITCH_BENDING) {
+			zt=preset->zone_tables+__atomic_load_n(&preset->zone_table, __ATOMIC_ACQUIRE);
+			uint16_t *zone_note=&midi_filter.zone_note[event_chan][event_num];
+			int note_off=(event_type==NOTE_OFF || (event_type==NOTE_ON && event_val==0));
+			//Held notes are released through their zones, even if they were removed
+			if (zt->chan_mask[event_chan] || (*zone_note && (note_off || event_type==KEY_PRESS))) {
+				if (event_type==NOTE_ON && event_val>0) {
+					zn_mask=zt->note_mask[event_chan][event_num] & zt->vel_mask[event_val];
+					*zone_note=zn_mask;
+				} else if (note_off) {
+					zn_mask=*zone_note;
+					*zone_note=0;
+				} else if (event_type==KEY_PRESS) {
+					zn_mask=*zone_note;
+				} else {
+					zn_mask=zt->chan_mask[event_chan];
+				}
+				//Zoned channels are not cloned
+				clone_from_chan=-1;
+				if (!zn_mask) continue;
+				zn_type=event_type;
+				zn_chan=event_chan;
+				zn_num=event_num;
+				zn_val=event_val;
+				zn_size=ev.size;
+				memcpy(zn_orig, ev.buffer, zn_size);
+				zn_next=1;
+			}
+		}
+		//... and expand a zone per loop iteration
+		if (zn_next) {
+			int izn=__builtin_ctz(zn_mask);
+			struct mf_zone_st *zone=zt->zones+izn;
+			zn_mask&=zn_mask-1;
+			event_chan=zone->chan_to;
+			ev.buffer=zn_buffer;
+			memcpy(ev.buffer, zn_orig, zn_size);
+			ev.size=zn_size;
+			if (event_type==NOTE_OFF || event_type==NOTE_ON || event_type==KEY_PRESS) {
+				//Note target is resolved on note-on & kept while the note is held
+				uint16_t *target=&midi_filter.zone_note_target[zn_chan][zn_num][izn];
+				if (event_type==NOTE_ON && event_val>0) {
+					int note=event_num+zone->transpose;
+					*target=(note>0x7F || note<0) ? 0xFFFF : (zone->chan_to << 8) | note;
+				}
+				if (*target==0xFFFF) continue;
+				event_chan=*target >> 8;
+				event_num=ev.buffer[1]=*target & 0x7F;
+			}
+			ev.buffer[0]=(ev.buffer[0] & 0xF0) | event_chan;
 		}
 
 		//Event Mapping
-		if ((zmip->flags & FLAG_ZMIP_FILTER) && event_type>=NOTE_OFF && event_type<=PITCH_BENDING) {
-			struct midi_event_st *event_map=&midi_filter.event_map[event_type & 0x7][event_chan][event_num];
+		if ((flags & FLAG_ZMIP_FILTER) && event_type>=NOTE_OFF && event_type<=PITCH_BENDING) {
+			struct midi_event_st *event_map=&preset->event_map[event_type & 0x7][event_chan][event_num];
+			//One-to-many => expand a target per loop iteration
+			if (mm_next || event_map->multimap) {
+				if (!mm_next) {
+					struct mf_multimap_table_st *mt=get_multimap_table(preset);
+					struct mf_multimap_st *mm=mt->multimaps+event_map->multimap-1;
+					mm_targets=mt->pool+mm->first;
+					mm_n=mm->n_targets;
+					mm_i=0;
+					mm_type=event_type;
+					mm_chan=event_chan;
+					mm_num=event_num;
+					mm_val=event_val;
+				}
+				struct mf_target_st *target=mm_targets+mm_i;
+				if (++mm_i>=mm_n) mm_targets=NULL;
+				//Scale value to the target range => curve LUT or linear. Note-on velocity 0 is kept.
+				if (event_val>0 || target->type!=NOTE_ON) {
+					if (target->curve) {
+						event_val=preset->curve_luts[target->curve-1][event_val];
+					} else {
+						int range=(int)target->val_max-target->val_min;
+						event_val=target->val_min+((int)event_val*range+(range>=0 ? 63 : -63))/127;
+					}
+				}
+				event_type=target->type;
+				event_chan=target->chan;
+				ev.buffer=mm_buffer;
+				ev.buffer[0]=(event_type << 4) | event_chan;
+				if (event_type==PROG_CHANGE || event_type==CHAN_PRESS) {
+					event_num=event_val;
+					ev.buffer[1]=event_val;
+					event_val=0;
+					ev.size=2;
+				} else if (event_type==PITCH_BENDING) {
+					event_num=0;
+					ev.buffer[1]=0;
+					ev.buffer[2]=event_val;
+					ev.size=3;
+				} else {
+					event_num=target->num;
+					ev.buffer[1]=event_num;
+					ev.buffer[2]=event_val;
+					ev.size=3;
+				}
+			}
 			//Ignore event...
-			if (event_map->type==IGNORE_EVENT) {
+			else if (event_map->type==IGNORE_EVENT) {
 				//fprintf (stdout, "IGNORE => %x, %x, %x\n",event_type, event_chan, event_num);
 				continue;
 			}
 			//Map event ...
-			if (event_map->type>=0 || event_map->type==SWAP_EVENT) {
+			else if (event_map->type>=0 || event_map->type==SWAP_EVENT) {
 				//fprintf (stdout, "ZynMidiRouter: Event Map %x, %x => ",ev.buffer[0],ev.buffer[1]);
 				if (event_map->type!=SWAP_EVENT) event_type=event_map->type;
 				event_chan=event_map->chan;
@@ -924,19 +2357,35 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 				}
 				//fprintf (stdout, "MIDI MSG => %x, %x\n",ev.buffer[0],ev.buffer[1]);
 			}
+			//Value curve => keep note-on velocity 0 (note-off)
+			if (!mm_next && !event_map->multimap && event_map->curve && ev.size==3 && !(event_type==NOTE_ON && event_val==0)) {
+				event_val=preset->curve_luts[event_map->curve-1][event_val];
+				ev.buffer[2]=event_val;
+				curved=1;
+			}
+		}
+
+		//Velocity curves => note-on velocity 0 is kept by the table
+		if ((flags & FLAG_ZMIP_FILTER) && (event_type==NOTE_ON || event_type==NOTE_OFF) && ev.size==3) {
+			struct mf_velocity_curve_st *vc=&midi_filter.velocity_curve[event_chan][event_type==NOTE_ON ? MIDI_VELOCITY_NOTE_ON : MIDI_VELOCITY_NOTE_OFF];
+			int ib=__atomic_load_n(&vc->active, __ATOMIC_ACQUIRE);
+			if (ib>=0) {
+				ev.buffer[2]=event_val=vc->lut[ib][event_val];
+				curved=1;
+			}
 		}
 
 		//Capture events for UI: MASTER CHANNEL + Program Change
-		if ((zmip->flags & FLAG_ZMIP_UI) && (event_chan==midi_filter.master_chan || event_type==PROG_CHANGE)) {
-			write_zynmidi((ev.buffer[0]<<16)|(ev.buffer[1]<<8)|(ev.buffer[2]));
+		if ((flags & FLAG_ZMIP_UI) && (event_chan==midi_filter.master_chan || event_type==PROG_CHANGE)) {
+			write_zynmidi_ext(zynmidi_frame_to_us(jack_cycle_frame+ev.time), ZYNMIDI_SRC_ZMIP|iz, ZYNMIDI_FLAG_MASTER, orig, ev.buffer);
 			continue;
 		}
 
 		//MIDI CC messages => TODO: Clone behaviour?!!
 		if (event_type==CTRL_CHANGE) {
 
-			//Auto Relative-Mode
-			if (midi_filter.ctrl_mode[event_chan][event_num]==1) {
+			//Auto Relative-Mode => not for high-resolution controllers
+			if (midi_filter.ctrl_mode[event_chan][event_num]==1 && !hr_kind && !ctrl_enc) {
 				// Change to absolut mode
 				if (midi_filter.ctrl_relmode_count[event_chan][event_num]>1) {
 					midi_filter.ctrl_mode[event_chan][event_num]=0;
@@ -959,7 +2408,7 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 			}
 
 			//Absolut Mode
-			if (midi_filter.ctrl_mode[event_chan][event_num]==0 && midi_ctrl_automode==1) {
+			if (midi_filter.ctrl_mode[event_chan][event_num]==0 && midi_ctrl_automode==1 && !hr_kind && !ctrl_enc) {
 				if (event_val==64) {
 					//printf("Tenting Relative Mode ...\n");
 					midi_filter.ctrl_mode[event_chan][event_num]=1;
@@ -975,20 +2424,20 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 			midi_filter.last_ctrl_val[event_chan][event_num]=event_val;
 
 			//Set zyncoder values
-			if (zmip->flags & FLAG_ZMIP_ZYNCODER) {
+			if (flags & FLAG_ZMIP_ZYNCODER) {
 				midi_event_zyncoders(event_chan, event_num, event_val);
 			}
 
 			//Ignore Bank Change events when FLAG_ZMIP_UI
-			//if ((zmip->flags & FLAG_ZMIP_UI) && (event_num==0 || event_num==32)) {
+			//if ((flags & FLAG_ZMIP_UI) && (event_num==0 || event_num==32)) {
 			//	continue;
 			//}
 		}
 
 		//Transpose Note-on/off messages => TODO: Bizarre clone behaviour?
-		else if ((zmip->flags & FLAG_ZMIP_TRANSPOSE) && midi_filter.transpose[event_chan]!=0) {
+		else if ((flags & FLAG_ZMIP_TRANSPOSE) && preset->transpose[event_chan]!=0) {
 			if (event_type==NOTE_OFF || event_type==NOTE_ON) {
-				int note=ev.buffer[1]+midi_filter.transpose[event_chan];
+				int note=ev.buffer[1]+preset->transpose[event_chan];
 				//If transposed note is out of range, ignore message ...
 				if (note>0x7F || note<0) continue;
 				event_num=ev.buffer[1]=(uint8_t)(note & 0x7F);
@@ -997,7 +2446,7 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 
 		// Fine-Tuning, using pitch-bending messages ...
 		xev.size=0;
-		if ((zmip->flags & FLAG_ZMIP_TUNING) && midi_filter.tuning_pitchbend>=0) {
+		if ((flags & FLAG_ZMIP_TUNING) && midi_filter.tuning_pitchbend>=0) {
 			if (event_type==NOTE_ON) {
 				int pb=midi_filter.last_pb_val[event_chan];
 				//printf("NOTE-ON PITCHBEND=%d (%d)\n",pb,midi_filter.tuning_pitchbend);
@@ -1029,118 +2478,228 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 		else if (event_type==NOTE_OFF) midi_filter.note_state[event_chan][event_num]=0;
 
 		//Capture events for UI: after filtering => [Note-Off, Note-On, Control-Change, SysEx]
-		if (!ui_event && (zmip->flags & FLAG_ZMIP_UI) && (event_type==NOTE_OFF || event_type==NOTE_ON || event_type==CTRL_CHANGE || event_type>=SYSTEM_EXCLUSIVE)) {
-			ui_event=(ev.buffer[0]<<16)|(ev.buffer[1]<<8)|(ev.buffer[2]);
+		if (!ui_event && (flags & FLAG_ZMIP_UI) && (event_type==NOTE_OFF || event_type==NOTE_ON || event_type==CTRL_CHANGE || event_type>=SYSTEM_EXCLUSIVE)) {
+			ui_event=1;
+			ui_flags=0;
+			memcpy(ui_data, ev.buffer, 3);
 		}
 
-		//Forward event to UI
-		if (ui_event) write_zynmidi(ui_event);
+		//Forward event to UI => aggregated high-resolution controllers in a single record
+		if (ui_event && hr_kind && ui_data[0]>>4==CTRL_CHANGE) {
+			uint8_t hr_orig[3]={ hr_lsb>=0 ? hr_lsb : 0, hr_param >> 7, hr_param & 0x7F };
+			if (hr_kind!=MIDI_HIRES_CC14) ui_data[1]=(hr_kind==MIDI_HIRES_PARAM_NRPN+1) ? 99 : 101;
+			write_zynmidi_ext(zynmidi_frame_to_us(jack_cycle_frame+ev.time), ZYNMIDI_SRC_ZMIP|iz, ui_flags|ZYNMIDI_FLAG_HIRES, hr_orig, ui_data);
+		}
+		else if (ui_event) write_zynmidi_ext(zynmidi_frame_to_us(jack_cycle_frame+ev.time), ZYNMIDI_SRC_ZMIP|iz, ui_flags, orig, ui_data);
 
-		//Forward message to the configured output ports
+		//Forward message to the configured output ports => non-channel ports + the event's channel port
 		int res=0;
-		for (j=0;j<MAX_NUM_ZMOPS;j++) {
-			if (zmip->fwd_zmops[j] && zmops[j].n_connections>0) {
-				if ((zmops[j].flags & FLAG_ZMOP_TUNING) && xev.size>0) {
+		int k;
+		int n_dest=n_zmops_nochan;
+		if (ev.buffer[0]<SYSTEM_EXCLUSIVE && zmop_chan[event_chan]>=0) n_dest++;
+		//Store event (and tuning event) once in the arena
+		int iev=midi_arena_add(ev.time, ev.buffer, ev.size);
+		if (iev<0) continue;
+		int ixev=-1;
+		if (xev.size>0) ixev=midi_arena_add(ev.time, xev.buffer, xev.size);
+		//High-resolution controllers => expand to NRPN/RPN number + MSB + LSB. Values
+		//changed by a curve or a one-to-many mapping are sent as 7-bit.
+		int ihr_pre=-1, ihr_post=-1;
+		if (hr_kind && event_type==CTRL_CHANGE && !curved && ev.buffer!=mm_buffer) {
+			jack_midi_data_t hr_data[6];
+			if (hr_kind!=MIDI_HIRES_CC14 && event_num==6) {
+				uint8_t sel=(hr_kind==MIDI_HIRES_PARAM_NRPN+1) ? 99 : 101;
+				hr_data[0]=hr_data[3]=ev.buffer[0];
+				hr_data[1]=sel;
+				hr_data[2]=hr_param >> 7;
+				hr_data[4]=sel-1;
+				hr_data[5]=hr_param & 0x7F;
+				ihr_pre=midi_arena_add(ev.time, hr_data, 3);
+				if (ihr_pre<0 || midi_arena_add(ev.time, hr_data+3, 3)<0) continue;
+			}
+			if (hr_lsb>=0 && (event_num<32 || (hr_kind!=MIDI_HIRES_CC14 && event_num==6))) {
+				hr_data[0]=ev.buffer[0];
+				hr_data[1]=event_num+32;
+				hr_data[2]=hr_lsb;
+				ihr_post=midi_arena_add(ev.time, hr_data, 3);
+			}
+		}
+		//Routing of a handed-off note-off => saved in its preset when it was swapped out
+		int *fwd_zmops=(preset==midi_filter.preset) ? zmip->fwd_zmops : preset->fwd_zmops[iz];
+		for (k=0;k<n_dest;k++) {
+			j=(k<n_zmops_nochan) ? zmops_nochan[k] : zmop_chan[event_chan];
+			if (fwd_zmops[j] && zmops[j].n_connections>0) {
+				if (ihr_pre>=0) {
+					zmop_push_index(j, ihr_pre, event_chan);
+					zmop_push_index(j, ihr_pre+1, event_chan);
+				}
+				if ((zmops[j].flags & FLAG_ZMOP_TUNING) && ixev>=0) {
 					if (event_type!=PITCH_BENDING) {
-						res=zmop_push_event(j, ev, event_chan);
+						res=zmop_push_index(j, iev, event_chan);
 					}
-					res=zmop_push_event(j, xev, event_chan);
+					res=zmop_push_index(j, ixev, event_chan);
 				}
-				else zmop_push_event(j, ev, event_chan);
+				else zmop_push_index(j, iev, event_chan);
+				if (ihr_post>=0) zmop_push_index(j, ihr_post, event_chan);
 			}
 		}
 
 	}
+	zmip->n_inject=0;
 	return 0;
 }
 
+//Flag-specialized variants
+#define ZMIP_PROCESS_VARIANT(name, zmip_flags) \
+	int name(int iz, jack_nframes_t nframes) { \
+		return jack_process_zmip_flags(iz, nframes, (zmip_flags)); \
+	}
+
+ZMIP_PROCESS_VARIANT(jack_process_zmip_main, ZMIP_MAIN_FLAGS & ZMIP_PROCESS_FLAGS_MASK)
+ZMIP_PROCESS_VARIANT(jack_process_zmip_seq, ZMIP_SEQ_FLAGS & ZMIP_PROCESS_FLAGS_MASK)
+ZMIP_PROCESS_VARIANT(jack_process_zmip_ctrl, ZMIP_CTRL_FLAGS & ZMIP_PROCESS_FLAGS_MASK)
+ZMIP_PROCESS_VARIANT(jack_process_zmip_thru, 0)
+
+//Generic variant => flags are read for every event
+int jack_process_zmip_generic(int iz, jack_nframes_t nframes) {
+	return jack_process_zmip_flags(iz, nframes, zmips[iz].flags);
+}
+
+struct zmip_process_variant_st zmip_process_variants[]={
+	{ ZMIP_MAIN_FLAGS & ZMIP_PROCESS_FLAGS_MASK, jack_process_zmip_main },
+	{ ZMIP_SEQ_FLAGS & ZMIP_PROCESS_FLAGS_MASK, jack_process_zmip_seq },
+	{ ZMIP_CTRL_FLAGS & ZMIP_PROCESS_FLAGS_MASK, jack_process_zmip_ctrl },
+	{ 0, jack_process_zmip_thru }
+};
+
+int zmip_specialized=1;
+
+//Select processing function for the zmip's flags
+void zmip_select_process(int iz) {
+	int i;
+	uint32_t flags=zmips[iz].flags & ZMIP_PROCESS_FLAGS_MASK;
+	zmip_process_func process=jack_process_zmip_generic;
+	if (zmip_specialized) {
+		for (i=0;i<sizeof(zmip_process_variants)/sizeof(zmip_process_variants[0]);i++) {
+			if (zmip_process_variants[i].flags==flags) {
+				process=zmip_process_variants[i].process;
+				break;
+			}
+		}
+	}
+	zmips[iz].process=process;
+}
+
+void set_zmip_specialized(int enable) {
+	int i;
+	zmip_specialized=enable;
+	for (i=0;i<MAX_NUM_ZMIPS;i++) zmip_select_process(i);
+}
+
+int jack_process_zmip(int iz, jack_nframes_t nframes) {
+	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
+		fprintf (stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+		return -1;
+	}
+	return zmips[iz].process(iz, nframes);
+}
+
 //-----------------------------------------------------
 // Process ZynMidi Output Port (zmop)
 //-----------------------------------------------------
 
+//End of the sorted run starting at i
+static inline int zmop_events_run_end(uint16_t *events, int i, int n_events) {
+	for (i++;i<n_events;i++) {
+		if (midi_arena.events[events[i]].time<midi_arena.events[events[i-1]].time) break;
+	}
+	return i;
+}
+
+//Sort event references by time => Stable natural merge sort. Every source (zmips,
+//internal, feedback ...) pushes a sorted run, so adjacent runs are merged by pairs,
+//O(n log(runs)), instead of sorting every event.
+void sort_zmop_events(uint16_t *events, int n_events) {
+	if (zmop_events_run_end(events, 0, n_events)>=n_events) return;
+	uint16_t *src=events;
+	uint16_t *dst=zmop_sort_buffer;
+	int n_runs;
+	do {
+		int i=0;
+		n_runs=0;
+		while (i<n_events) {
+			int a=i;
+			int b=zmop_events_run_end(src, a, n_events);
+			int e=(b<n_events) ? zmop_events_run_end(src, b, n_events) : b;
+			int k=a;
+			i=b;
+			//Left first on equal time
+			while (a<b && i<e) {
+				if (midi_arena.events[src[i]].time<midi_arena.events[src[a]].time) dst[k++]=src[i++];
+				else dst[k++]=src[a++];
+			}
+			while (a<b) dst[k++]=src[a++];
+			while (i<e) dst[k++]=src[i++];
+			n_runs++;
+		}
+		uint16_t *tmp=src;
+		src=dst;
+		dst=tmp;
+	} while (n_runs>1);
+	if (src!=events) memcpy(events, src, n_events*sizeof(uint16_t));
+}
+
 int jack_process_zmop(int iz, jack_nframes_t nframes) {
 	if (iz<0 || iz>=MAX_NUM_ZMOPS) {
 		fprintf (stderr, "ZynMidiRouter: Bad output port index (%d).\n", iz);
+		return -1;
 	}
 	struct zmop_st *zmop=zmops+iz;
 
-	int i=0;
-	int j;
-	uint8_t event_type;
-	uint8_t event_chan;
-	uint8_t event_num;
-	uint8_t event_val;
-	uint8_t event_size;
-
-	//Get MIDI jack data buffer and clear it
-	void *output_port_buffer = jack_port_get_buffer(zmop->jport, nframes);
-	if (output_port_buffer==NULL) {
-		fprintf (stderr, "ZynMidiRouter: Error allocating jack output port buffer: %d frames\n", nframes);
-		return -1;
+	//Get MIDI jack data buffer and clear it => Not in offline mode
+	void *output_port_buffer=NULL;
+	if (zmop->jport) {
+		output_port_buffer = jack_port_get_buffer(zmop->jport, nframes);
+		if (output_port_buffer==NULL) {
+			fprintf (stderr, "ZynMidiRouter: Error allocating jack output port buffer: %d frames\n", nframes);
+			return -1;
+		}
+		jack_midi_clear_buffer(output_port_buffer);
 	}
-	jack_midi_clear_buffer(output_port_buffer);
-
-	//fprintf(stderr, "ZynMidiRouter: Processing ZMOP %d\n",iz);
-
-	//Write MIDI data
-	//TODO: Avoid frame overflow by checking that num_zmop_events<nframes => implement ring buffer in zmop??
-	int pos=0;
-	while (pos < zmop->n_data) {
-		event_type= zmop->data[pos] >> 4;
 
-		//fprintf(stderr, "ZynMidiRouter: Processing Event of type %d\n",event_type);
+	//Latency probe marker, before any other event
+	if (midi_probe.enabled && iz==midi_probe.zmop && output_port_buffer) midi_probe_send(output_port_buffer);
 
-		if (zmop->data[pos]>=0xF4) event_size=1;
-		else if (event_type==PROG_CHANGE || event_type==CHAN_PRESS || event_type==TIME_CODE_QF || event_type==SONG_SELECT) event_size=2;
-		else event_size=3;
+	//fprintf(stderr, "ZynMidiRouter: Processing ZMOP %d\n",iz);
 
-		//Channel filter
-		if (zmop->midi_channel>=0) {
-			if (event_type<NOTE_OFF || event_type>PITCH_BENDING || zmop->midi_channel!=(zmop->data[pos]&0xF)) {
-				pos+=event_size;
-				continue;
-			}
-		}
+	//Sort event references by time
+	uint16_t *events=zmop->events;
+	uint16_t *rt_events=zmop->rt_events;
+	sort_zmop_events(events, zmop->n_events);
+	sort_zmop_events(rt_events, zmop->n_rt_events);
 
-		/*
-		//Master Channel Control
-		if (event_type==CTRL_CHANGE) {
-			event_chan=zmop->data[pos] & 0xF;
-			event_num=zmop->data[pos+1] & 0x7F;
-			event_val=zmop->data[pos+2] & 0x7F;
-
-			//Captured Controllers => volume
-			if (event_num==0x7) {
-				if (midi_filter.master_chan>=0) {
-					//if channel is master, resend ctrl messages to all normal channels ...
-					if (event_chan==midi_filter.master_chan) {
-						for (j=0;j<16;j++) {
-							if (j==midi_filter.master_chan) continue;
-							zynmidi_send_ccontrol_change(j,event_num,midi_filter.last_ctrl_val[j][event_num]);
-						}
-					//if channel is not master, scale value proportionally to Master Channel value ...
-					} else {
-						zmop->data[pos+2]=((int32_t)event_val*(uint32_t)midi_filter.last_ctrl_val[midi_filter.master_chan][event_num])>>7;
-					}
-				}
-			}
+	//Write MIDI data => merge the realtime lane, first on equal time
+	int i=0;
+	int irt=0;
+	while (i<zmop->n_events || irt<zmop->n_rt_events) {
+		struct zynmidi_event_st *ev;
+		if (irt<zmop->n_rt_events && (i>=zmop->n_events || midi_arena.events[rt_events[irt]].time<=midi_arena.events[events[i]].time)) {
+			ev=midi_arena.events+rt_events[irt++];
+		} else {
+			ev=midi_arena.events+events[i++];
 		}
-		*/
-
-		//fprintf(stderr, "ZynMidiRouter: Writing Event %d => %d\n",pos,i);
+		jack_nframes_t time=ev->time;
+		if (time>=nframes) time=nframes-1;
 
 		//Write to Jackd buffer
-		uint8_t *buffer = jack_midi_event_reserve(output_port_buffer, i, event_size);
-		memcpy(buffer, zmop->data+pos, event_size);
-		pos+=event_size;
-
-		//fprintf(stderr, "ZynMidiRouter: Processed Event %d\n",i);
-
-		i++;
-		if (i>nframes) {
-			fprintf (stderr, "ZynMidiRouter: Error processing jack midi output events: TOO MANY EVENTS\n");
-			return -1;
+		if (output_port_buffer) {
+			uint8_t *buffer = jack_midi_event_reserve(output_port_buffer, time, ev->size);
+			if (buffer) memcpy(buffer, ev->data, ev->size);
 		}
+		zynmidi_stats.zmop_events[iz]++;
+
+		//Capture output events
+		if (midi_capture_zmops & (1<<iz)) capture_midi_event(iz|MIDI_CAPTURE_ZMOP, jack_cycle_frame+time, ev->data, ev->size);
 	}
 
 	return 0;
@@ -1154,10 +2713,11 @@ int jack_process_zmop(int iz, jack_nframes_t nframes) {
 int forward_internal_midi_data();
 int forward_ctrlfb_midi_data();
 
-int jack_process(jack_nframes_t nframes, void *arg) {
+int jack_process_cycle(jack_nframes_t nframes) {
 	int i;
 
-	// Get current Active Chan
+	// Get current cycle's frame time & Active Chan => In offline mode, frame time is set by caller
+	if (jack_client) jack_cycle_frame=jack_last_frame_time(jack_client);
 	current_midi_filter_active_chan=midi_filter.active_chan;
 	
 	//---------------------------------
@@ -1166,14 +2726,40 @@ int jack_process(jack_nframes_t nframes, void *arg) {
 	zmops_clear_data();
 	//fprintf(stderr, "ZynMidiRouter: ZMOP data cleaned\n");
 
+	//---------------------------------
+	// Swap MIDI preset, if requested
+	//---------------------------------
+	if (midi_preset_pending>=0) swap_midi_preset();
+
 	//---------------------------------
 	// Get number of connection of Output Ports
 	//---------------------------------
+	//In offline mode, connections are set by caller
 	for (i=0;i<MAX_NUM_ZMOPS;i++) {
-		zmops[i].n_connections=jack_port_connected(zmops[i].jport);
+		if (zmops[i].jport) zmops[i].n_connections=jack_port_connected(zmops[i].jport);
 	}
 	//fprintf(stderr, "ZynMidiRouter: Num. of connections refreshed\n");
 
+	//---------------------------------
+	//Replayed MIDI events
+	//---------------------------------
+	if (midi_replay_running) inject_midi_replay_events(nframes);
+
+	//---------------------------------
+	//Scheduled MIDI events
+	//---------------------------------
+	inject_midi_sched_events(nframes);
+
+	//---------------------------------
+	//MIDI Player
+	//---------------------------------
+	inject_midi_player_events(nframes);
+
+	//---------------------------------
+	//Internal MIDI Clock
+	//---------------------------------
+	generate_midi_clock(nframes);
+
 	//---------------------------------
 	//MIDI Input
 	//---------------------------------
@@ -1210,6 +2796,204 @@ int jack_process(jack_nframes_t nframes, void *arg) {
 	return 0;
 }
 
+int jack_process(jack_nframes_t nframes, void *arg) {
+	//Begin state update => seq is odd
+	zynmidi_stats.seq++;
+	__sync_synchronize();
+
+	//Reset event arena
+	midi_arena.n_events=0;
+
+	int res=jack_process_cycle(nframes);
+	zynmidi_stats.cycles++;
+
+	//Export changed state to shared memory
+	publish_zynmidi_state();
+
+	//End state update => seq is even
+	__sync_synchronize();
+	zynmidi_stats.seq++;
+	return res;
+}
+
+//Wait for the end of the RT cycle in progress, if any => data unpublished before
+//calling is not used by the RT thread anymore. Offline, cycles run in the caller's thread.
+void wait_midi_cycle() {
+	int retries;
+	if (!jack_client) return;
+	//Published data must be visible before the cycle state is read
+	__sync_synchronize();
+	uint32_t seq=zynmidi_stats.seq;
+	if (!(seq & 1)) return;
+	//Timeout => jack is stopped or stalled
+	for (retries=0;retries<10000 && zynmidi_stats.seq==seq;retries++) usleep(100);
+}
+
+//-----------------------------------------------------
+// MIDI Latency Probe
+//-----------------------------------------------------
+
+int start_midi_probe(int izmop, int izmip, int interval_ms, int bin_frames, int loopback) {
+	if (izmop<0 || izmop>=MAX_NUM_ZMOPS) {
+		fprintf (stderr, "ZynMidiRouter: Bad output port index (%d).\n", izmop);
+		return 0;
+	}
+	if (izmip<0 || izmip>=MAX_NUM_ZMIPS) {
+		fprintf (stderr, "ZynMidiRouter: Bad input port index (%d).\n", izmip);
+		return 0;
+	}
+	if (!jack_client) {
+		fprintf (stderr, "ZynMidiRouter: MIDI latency probe needs a jack client.\n");
+		return 0;
+	}
+	if (interval_ms<=0 || bin_frames<=0) {
+		fprintf (stderr, "ZynMidiRouter: Bad MIDI latency probe parameters (%d ms, %d frames).\n", interval_ms, bin_frames);
+		return 0;
+	}
+	stop_midi_probe();
+
+	if (loopback && jack_connect(jack_client, jack_port_name(zmops[izmop].jport), jack_port_name(zmips[izmip].jport))) {
+		fprintf (stderr, "ZynMidiRouter: Can't connect MIDI latency probe loopback.\n");
+		return 0;
+	}
+	midi_probe.zmop=izmop;
+	midi_probe.zmip=izmip;
+	midi_probe.loopback=loopback;
+	midi_probe.interval=(jack_nframes_t)((uint64_t)interval_ms*jack_sample_rate/1000);
+	if (midi_probe.interval==0) midi_probe.interval=1;
+	midi_probe.next_frame=jack_cycle_frame;
+	midi_probe.seq=0;
+	memset(midi_probe.pending, 0, sizeof(midi_probe.pending));
+	reset_midi_probe_stats();
+	midi_probe.stats.bin_frames=bin_frames;
+	__sync_synchronize();
+	midi_probe.enabled=1;
+	return 1;
+}
+
+int stop_midi_probe() {
+	if (!midi_probe.enabled) return 0;
+	midi_probe.enabled=0;
+	if (midi_probe.loopback && jack_client) {
+		jack_disconnect(jack_client, jack_port_name(zmops[midi_probe.zmop].jport), jack_port_name(zmips[midi_probe.zmip].jport));
+	}
+	return 1;
+}
+
+void reset_midi_probe_stats() {
+	uint32_t bin_frames=midi_probe.stats.bin_frames;
+	memset(&midi_probe.stats, 0, sizeof(midi_probe.stats));
+	midi_probe.stats.min=UINT32_MAX;
+	midi_probe.stats.bin_frames=bin_frames;
+}
+
+struct midi_probe_stats_st *get_midi_probe_stats() {
+	return &midi_probe.stats;
+}
+
+//Send marker at the cycle's first frame, if it's time => Call from RT thread!
+void midi_probe_send(void *port_buffer) {
+	if ((int32_t)(jack_cycle_frame-midi_probe.next_frame)<0) return;
+	uint8_t *buffer=jack_midi_event_reserve(port_buffer, 0, MIDI_PROBE_MSG_SIZE);
+	if (!buffer) return;
+	uint16_t seq=midi_probe.seq++ & 0x3FFF;
+	buffer[0]=SYSTEM_EXCLUSIVE;
+	buffer[1]=MIDI_PROBE_MANUFACTURER_ID;
+	buffer[2]=MIDI_PROBE_TAG;
+	buffer[3]=seq >> 7;
+	buffer[4]=seq & 0x7F;
+	buffer[5]=END_SYSTEM_EXCLUSIVE;
+	//Not returned in time => lost
+	int i=seq % MIDI_PROBE_MAX_PENDING;
+	if (midi_probe.pending[i]) midi_probe.stats.lost++;
+	midi_probe.pending[i]=1;
+	midi_probe.pending_seq[i]=seq;
+	midi_probe.pending_frame[i]=jack_cycle_frame;
+	midi_probe.stats.sent++;
+	midi_probe.next_frame+=midi_probe.interval;
+	//Don't try to catch up after xruns, etc.
+	if ((int32_t)(jack_cycle_frame-midi_probe.next_frame)>=0) midi_probe.next_frame=jack_cycle_frame+midi_probe.interval;
+}
+
+//Detect marker and record latency => Return 1 if event was a marker. Call from RT thread!
+int midi_probe_receive(jack_midi_event_t *ev) {
+	if (ev->size!=MIDI_PROBE_MSG_SIZE || ev->buffer[1]!=MIDI_PROBE_MANUFACTURER_ID || ev->buffer[2]!=MIDI_PROBE_TAG) return 0;
+	uint16_t seq=(ev->buffer[3] << 7) | ev->buffer[4];
+	int i=seq % MIDI_PROBE_MAX_PENDING;
+	if (!midi_probe.pending[i] || midi_probe.pending_seq[i]!=seq) return 1;
+	midi_probe.pending[i]=0;
+
+	struct midi_probe_stats_st *stats=&midi_probe.stats;
+	uint32_t latency=jack_cycle_frame+ev->time-midi_probe.pending_frame[i];
+	uint32_t bin=latency/stats->bin_frames;
+	if (bin>=MIDI_PROBE_HIST_SIZE) bin=MIDI_PROBE_HIST_SIZE-1;
+	stats->hist[bin]++;
+	if (latency<stats->min) stats->min=latency;
+	if (latency>stats->max) stats->max=latency;
+	stats->sum+=latency;
+	stats->received++;
+	return 1;
+}
+
+//-----------------------------------------------------
+// Router State Views => UI
+//-----------------------------------------------------
+
+struct zynmidi_stats_st *get_zynmidi_stats() {
+	return &zynmidi_stats;
+}
+
+uint8_t *get_midi_filter_last_ctrl_val_array() {
+	return (uint8_t *)midi_filter.last_ctrl_val;
+}
+
+uint8_t *get_midi_filter_note_state_array() {
+	return (uint8_t *)midi_filter.note_state;
+}
+
+uint16_t *get_midi_filter_last_pb_val_array() {
+	return midi_filter.last_pb_val;
+}
+
+int *get_midi_filter_transpose_array() {
+	return midi_filter.preset->transpose;
+}
+
+struct mf_clone_st *get_midi_filter_clone_array() {
+	return (struct mf_clone_st *)midi_filter.preset->clone;
+}
+
+//Get a consistent copy of the router state. Return 0 if the RT thread keeps it busy.
+int get_midi_filter_snapshot(struct midi_filter_snapshot_st *snap) {
+	int i, j, retries;
+	for (retries=0;retries<1000;retries++) {
+		uint32_t seq=zynmidi_stats.seq;
+		if (seq & 1) {
+			usleep(100);
+			continue;
+		}
+		__sync_synchronize();
+		struct mf_preset_st *preset=midi_filter.preset;
+		snap->master_chan=midi_filter.master_chan;
+		snap->active_chan=midi_filter.active_chan;
+		snap->preset=preset-midi_presets;
+		memcpy(snap->transpose, preset->transpose, sizeof(snap->transpose));
+		for (i=0;i<16;i++) {
+			for (j=0;j<16;j++) snap->clone[i][j]=preset->clone[i][j].enabled;
+		}
+		memcpy(snap->last_pb_val, midi_filter.last_pb_val, sizeof(snap->last_pb_val));
+		memcpy(snap->last_ctrl_val, midi_filter.last_ctrl_val, sizeof(snap->last_ctrl_val));
+		memcpy(snap->note_state, midi_filter.note_state, sizeof(snap->note_state));
+		__sync_synchronize();
+		if (zynmidi_stats.seq==seq) {
+			snap->seq=seq;
+			return 1;
+		}
+	}
+	fprintf (stderr, "ZynMidiRouter: Can't get a consistent snapshot of the MIDI filter state!\n");
+	return 0;
+}
+
 //-----------------------------------------------------
 // MIDI Internal Input <= UI and internal
 //-----------------------------------------------------
@@ -1262,11 +3046,34 @@ int forward_internal_midi_data() {
 		fprintf (stderr, "ZynMidiRouter: Error reading midi data from internal output ring-buffer: %d bytes\n", nb);
 		return -1;
 	}
-	//TODO: Avoid buffer overflow => check that nb<=(JACK_MIDI_BUFFER_SIZE-n_data)
-	int i;
-	for (i=0;i<ZMOP_CTRL;i++) {
-		memcpy(zmops[i].data+zmops[i].n_data, internal_midi_data, nb);
-		zmops[i].n_data+=nb;
+	//Add events to arena & push references => non-channel zmops + the event's channel zmop
+	int i, iz, ie;
+	int pos=0;
+	while (pos<nb) {
+		uint8_t status=internal_midi_data[pos];
+		//Skip stray data bytes
+		if (!(status & 0x80)) {
+			pos++;
+			continue;
+		}
+		int size=MIDI_STATUS_SIZE(status);
+		//SysEx can't be stored in the arena => skip status, data bytes are skipped as stray
+		if (size==0) {
+			pos++;
+			continue;
+		}
+		if (pos+size>nb) break;
+		ie=midi_arena_add(0, internal_midi_data+pos, size);
+		if (ie<0) break;
+		for (i=0;i<n_zmops_nochan;i++) {
+			iz=zmops_nochan[i];
+			if (iz<ZMOP_CTRL) zmop_push_index(iz, ie, -1);
+		}
+		if (status<SYSTEM_EXCLUSIVE) {
+			iz=zmop_chan[status & 0x0F];
+			if (iz>=0 && iz<ZMOP_CTRL) zmop_push_index(iz, ie, status & 0x0F);
+		}
+		pos+=size;
 	}
 	return nb;
 }
@@ -1379,9 +3186,29 @@ int forward_ctrlfb_midi_data() {
 		return -1;
 	}
 
-	//TODO: Avoid buffer overflow => check that nb<=(JACK_MIDI_BUFFER_SIZE-n_data)
-	memcpy(zmops[ZMOP_CTRL].data+zmops[ZMOP_CTRL].n_data, ctrlfb_midi_data, nb);
-	zmops[ZMOP_CTRL].n_data+=nb;
+	int pos=0;
+	while (pos<nb) {
+		//Skip stray data bytes
+		if (!(ctrlfb_midi_data[pos] & 0x80)) {
+			pos++;
+			continue;
+		}
+		int size=MIDI_STATUS_SIZE(ctrlfb_midi_data[pos]);
+		//SysEx can't be stored in the arena => skip status, data bytes are skipped as stray
+		if (size==0) {
+			pos++;
+			continue;
+		}
+		if (pos+size>nb) break;
+		//Translate to the controller side
+		uint8_t data[3];
+		memcpy(data, ctrlfb_midi_data+pos, size);
+		pos+=size;
+		if (!reverse_ctrlfb_event(data, &size)) continue;
+		int ie=midi_arena_add(0, data, size);
+		if (ie<0) break;
+		zmop_push_index(ZMOP_CTRL, ie, -1);
+	}
 
 	return nb;
 }
@@ -1390,6 +3217,103 @@ int forward_ctrlfb_midi_data() {
 // Send Functions
 //------------------------------
 
+int reverse_ctrlfb_event(uint8_t *data, int *size) {
+	//Only channel messages are translated
+	if (data[0]<NOTE_OFF<<4 || data[0]>=SYSTEM_EXCLUSIVE) return 1;
+	uint32_t flags=zmips[ZMIP_MAIN].flags;
+	int type=data[0]>>4;
+	int chan=data[0] & 0x0F;
+	int num=0;
+	int val;
+	if (type==PROG_CHANGE || type==CHAN_PRESS) {
+		num=data[1];
+		val=0x7F;
+	} else if (type==PITCH_BENDING) {
+		val=data[2];
+	} else {
+		num=data[1];
+		val=data[2];
+	}
+
+	//Master channel events are not mapped
+	if (chan==midi_filter.master_chan) return 1;
+
+	struct mf_preset_st *preset=midi_filter.preset;
+	int zoned=0;
+	if (flags & FLAG_ZMIP_FILTER) {
+		//Event map => O(1) reverse index
+		struct midi_event_st *rev=&preset->rev_event_map[type & 0x7][chan][num & 0x7F];
+		if (rev->type==NONE_EVENT) return 0;
+		//Value => inverse of the target range & curve. Note-on velocity 0 is kept.
+		struct midi_event_st *map=&preset->event_map[rev->type & 0x7][rev->chan][rev->num];
+		if (type!=PROG_CHANGE && type!=CHAN_PRESS && !(type==NOTE_ON && val==0)) {
+			if (map->multimap && rev->multimap) {
+				struct mf_multimap_table_st *mt=get_multimap_table(preset);
+				struct mf_multimap_st *mm=mt->multimaps+map->multimap-1;
+				if (rev->multimap<=mm->n_targets) {
+					struct mf_target_st *target=mt->pool+mm->first+rev->multimap-1;
+					if (target->curve) val=preset->curve_inv_luts[target->curve-1][val];
+					else val=unscale_mf_target_val(target, val);
+				}
+			} else if (!map->multimap && map->curve) {
+				val=preset->curve_inv_luts[map->curve-1][val];
+			}
+		}
+		type=rev->type;
+		chan=rev->chan;
+		num=rev->num;
+
+		//Zones => Feedback for a zone target channel goes to its source channel
+		struct mf_zone_table_st *zt=preset->zone_tables+__atomic_load_n(&preset->zone_table, __ATOMIC_ACQUIRE);
+		int i;
+		for (i=0;i<MAX_MIDI_ZONES;i++) {
+			struct mf_zone_st *zone=zt->zones+i;
+			if (!zone->enabled || zone->chan_to!=chan) continue;
+			if (type==NOTE_OFF || type==NOTE_ON || type==KEY_PRESS) {
+				int note=num-zone->transpose;
+				if (note<zone->note_min || note>zone->note_max) continue;
+				num=note;
+			}
+			chan=zone->chan_from;
+			zoned=1;
+			break;
+		}
+	}
+
+	//Clone => Feedback for a cloned channel goes to the source channel. Zoned channels are not cloned.
+	if ((flags & FLAG_ZMIP_CLONE) && !zoned) {
+		int i;
+		for (i=0;i<16;i++) {
+			struct mf_clone_st *clone=&preset->clone[i][chan];
+			if (i!=chan && clone->enabled && (type!=CTRL_CHANGE || clone->cc[num])) {
+				chan=i;
+				break;
+			}
+		}
+	}
+
+	//Active channel => Controller only drives the active channel
+	if (midi_filter.active_chan>=0) {
+		if (chan!=midi_filter.active_chan) return 0;
+		if (midi_filter.active_chan_src>=0) chan=midi_filter.active_chan_src;
+	}
+
+	data[0]=(type << 4) | chan;
+	if (type==PROG_CHANGE || type==CHAN_PRESS) {
+		data[1]=num;
+		*size=2;
+	} else if (type==PITCH_BENDING) {
+		data[1]=0;
+		data[2]=val;
+		*size=3;
+	} else {
+		data[1]=num;
+		data[2]=val;
+		*size=3;
+	}
+	return 1;
+}
+
 int ctrlfb_send_note_off(uint8_t chan, uint8_t note, uint8_t vel) {
 	uint8_t buffer[3];
 	buffer[0] = 0x80 + (chan & 0x0F);
@@ -1435,31 +3359,180 @@ int ctrlfb_send_pitchbend_change(uint8_t chan, uint16_t pb) {
 // MIDI Internal Ouput Events Buffer => UI
 //-----------------------------------------------------------------------------
 
-uint32_t zynmidi_buffer[ZYNMIDI_BUFFER_SIZE];
+//RT ring => written only by the RT thread
+struct zynmidi_ui_event_st zynmidi_buffer[ZYNMIDI_BUFFER_SIZE];
 int zynmidi_buffer_read;
 int zynmidi_buffer_write;
 
+//Non-RT ring => multiple producers (switch & encoder ISRs, UI). Slots are reserved
+//atomically and each one has a sequence number telling if it's free or written.
+struct zynmidi_mp_slot_st {
+	volatile uint32_t seq;
+	struct zynmidi_ui_event_st ev;
+};
+struct zynmidi_mp_slot_st zynmidi_mp_buffer[ZYNMIDI_BUFFER_SIZE];
+volatile uint32_t zynmidi_mp_write;
+uint32_t zynmidi_mp_read;
+
+//Encoder values for extended readers => coalesced, only the last value is kept
+volatile uint32_t zynmidi_coder_data[ZYNMIDI_SRC_INDEX_MASK+1];
+volatile uint32_t zynmidi_coder_pending;
+struct zynmidi_ui_event_st zynmidi_coder_queue[ZYNMIDI_SRC_INDEX_MASK+1];
+int zynmidi_coder_queue_n;
+int zynmidi_coder_queue_i;
+
 int init_zynmidi_buffer() {
 	int i;
-	for (i=0;i<ZYNMIDI_BUFFER_SIZE;i++) zynmidi_buffer[i]=0;
+	memset(zynmidi_buffer, 0, sizeof(zynmidi_buffer));
 	zynmidi_buffer_read=zynmidi_buffer_write=0;
+	memset(zynmidi_mp_buffer, 0, sizeof(zynmidi_mp_buffer));
+	for (i=0;i<ZYNMIDI_BUFFER_SIZE;i++) zynmidi_mp_buffer[i].seq=i;
+	zynmidi_mp_write=zynmidi_mp_read=0;
+	memset((void *)zynmidi_coder_data, 0, sizeof(zynmidi_coder_data));
+	zynmidi_coder_pending=0;
+	zynmidi_coder_queue_n=zynmidi_coder_queue_i=0;
+	memset(&zynmidi_stats, 0, sizeof(zynmidi_stats));
 	return 1;
 }
 
-int write_zynmidi(uint32_t ev) {
+uint64_t get_zynmidi_time_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+//Jack frame => microseconds, in the same clock as get_zynmidi_time_us (jack uses CLOCK_MONOTONIC)
+uint64_t zynmidi_frame_to_us(jack_nframes_t frame) {
+	if (jack_client) return jack_frames_to_time(jack_client, frame);
+	if (jack_sample_rate) return (uint64_t)frame*1000000/jack_sample_rate;
+	return 0;
+}
+
+int write_zynmidi_ext(uint64_t time_us, uint8_t src, uint8_t flags, const uint8_t *orig, const uint8_t *data) {
+	struct zynmidi_ui_event_st ev;
+	ev.time_us=time_us;
+	ev.src=src;
+	ev.flags=flags;
+	memcpy(ev.orig, orig, 3);
+	memcpy(ev.data, data, 3);
+	//Broadcast subscribers get all events, even if the UI ring is full
+	zynmidi_bcast_write(&ev);
+
 	int nptr=zynmidi_buffer_write+1;
 	if (nptr>=ZYNMIDI_BUFFER_SIZE) nptr=0;
-	if (nptr==zynmidi_buffer_read) return 0;
+	if (nptr==zynmidi_buffer_read) {
+		zynmidi_stats.ui_overflows++;
+		return 0;
+	}
 	zynmidi_buffer[zynmidi_buffer_write]=ev;
+	//Record must be complete before it's visible to reader
+	__sync_synchronize();
 	zynmidi_buffer_write=nptr;
 	return 1;
 }
 
+int write_zynmidi_src(uint8_t src, uint8_t flags, uint32_t ev) {
+	struct zynmidi_ui_event_st uev;
+	uev.time_us=get_zynmidi_time_us();
+	uev.src=src;
+	uev.flags=flags;
+	uev.data[0]=(ev >> 16) & 0xFF;
+	uev.data[1]=(ev >> 8) & 0xFF;
+	uev.data[2]=ev & 0xFF;
+	memcpy(uev.orig, uev.data, 3);
+	zynmidi_bcast_write(&uev);
+
+	//Encoder values only for extended readers => coalesced, they don't take ring slots
+	if ((src & ZYNMIDI_SRC_TYPE_MASK)==ZYNMIDI_SRC_ENCODER && (flags & ZYNMIDI_FLAG_EXT_ONLY)) {
+		__atomic_store_n(&zynmidi_coder_data[src & ZYNMIDI_SRC_INDEX_MASK], 0x80000000 | (ev & 0xFFFFFF), __ATOMIC_RELEASE);
+		__atomic_store_n(&zynmidi_coder_pending, 1, __ATOMIC_RELEASE);
+		return 1;
+	}
+
+	//Reserve a slot
+	uint32_t pos=__atomic_load_n(&zynmidi_mp_write, __ATOMIC_RELAXED);
+	struct zynmidi_mp_slot_st *slot;
+	while (1) {
+		slot=zynmidi_mp_buffer+(pos & (ZYNMIDI_BUFFER_SIZE-1));
+		int32_t dif=(int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE)-pos);
+		if (dif==0) {
+			if (__atomic_compare_exchange_n(&zynmidi_mp_write, &pos, pos+1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+		}
+		else if (dif<0) {
+			__sync_fetch_and_add(&zynmidi_stats.ui_overflows, 1);
+			return 0;
+		}
+		else pos=__atomic_load_n(&zynmidi_mp_write, __ATOMIC_RELAXED);
+	}
+	slot->ev=uev;
+	//Record must be complete before it's visible to reader
+	__atomic_store_n(&slot->seq, pos+1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+int write_zynmidi(uint32_t ev) {
+	return write_zynmidi_src(ZYNMIDI_SRC_INTERNAL, 0, ev);
+}
+
+//Read next record from the RT & non-RT rings, in time order
+int read_zynmidi_rings(struct zynmidi_ui_event_st *ev) {
+	struct zynmidi_mp_slot_st *slot=zynmidi_mp_buffer+(zynmidi_mp_read & (ZYNMIDI_BUFFER_SIZE-1));
+	int mp_ready=(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE)==zynmidi_mp_read+1);
+	int rt_ready=(zynmidi_buffer_read!=zynmidi_buffer_write);
+	__sync_synchronize();
+	if (rt_ready && (!mp_ready || zynmidi_buffer[zynmidi_buffer_read].time_us<=slot->ev.time_us)) {
+		*ev=zynmidi_buffer[zynmidi_buffer_read];
+		__sync_synchronize();
+		int nptr=zynmidi_buffer_read+1;
+		if (nptr>=ZYNMIDI_BUFFER_SIZE) nptr=0;
+		zynmidi_buffer_read=nptr;
+		return 1;
+	}
+	if (mp_ready) {
+		*ev=slot->ev;
+		//Free the slot for the next round
+		__atomic_store_n(&slot->seq, zynmidi_mp_read+ZYNMIDI_BUFFER_SIZE, __ATOMIC_RELEASE);
+		zynmidi_mp_read++;
+		return 1;
+	}
+	return 0;
+}
+
+int read_zynmidi_ext(struct zynmidi_ui_event_st *ev) {
+	//Changed encoder values => queued when the queue is empty
+	if (zynmidi_coder_queue_i>=zynmidi_coder_queue_n && __atomic_exchange_n(&zynmidi_coder_pending, 0, __ATOMIC_ACQ_REL)) {
+		int i;
+		uint64_t time_us=get_zynmidi_time_us();
+		zynmidi_coder_queue_n=zynmidi_coder_queue_i=0;
+		for (i=0;i<=ZYNMIDI_SRC_INDEX_MASK;i++) {
+			uint32_t data=__atomic_exchange_n(&zynmidi_coder_data[i], 0, __ATOMIC_ACQ_REL);
+			if (!data) continue;
+			struct zynmidi_ui_event_st *qev=zynmidi_coder_queue+zynmidi_coder_queue_n++;
+			qev->time_us=time_us;
+			qev->src=ZYNMIDI_SRC_ENCODER | i;
+			qev->flags=ZYNMIDI_FLAG_EXT_ONLY;
+			qev->data[0]=(data >> 16) & 0xFF;
+			qev->data[1]=(data >> 8) & 0xFF;
+			qev->data[2]=data & 0xFF;
+			memcpy(qev->orig, qev->data, 3);
+		}
+	}
+	if (zynmidi_coder_queue_i<zynmidi_coder_queue_n) {
+		*ev=zynmidi_coder_queue[zynmidi_coder_queue_i++];
+		return 1;
+	}
+	return read_zynmidi_rings(ev);
+}
+
 uint32_t read_zynmidi() {
-	if (zynmidi_buffer_read==zynmidi_buffer_write) return 0;
-	uint32_t ev=zynmidi_buffer[zynmidi_buffer_read++];
-	if (zynmidi_buffer_read>=ZYNMIDI_BUFFER_SIZE) zynmidi_buffer_read=0;
-	return ev;
+	struct zynmidi_ui_event_st ev;
+	while (read_zynmidi_rings(&ev)) {
+		if (ev.flags & ZYNMIDI_FLAG_EXT_ONLY) continue;
+		//Aggregated NRPN/RPN => no 7-bit equivalent
+		if ((ev.flags & ZYNMIDI_FLAG_HIRES) && (ev.data[1]==99 || ev.data[1]==101)) continue;
+		return ZYNMIDI_PACK(ev.data[0], ev.data[1], ev.data[2]);
+	}
+	return 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -27,12 +27,16 @@
 #include <jack/midiport.h>
 #include <jack/ringbuffer.h>
 
+#include "zynmidistatus.h"
+
 //-----------------------------------------------------------------------------
 // Library Initialization
 //-----------------------------------------------------------------------------
 
 int init_zynmidirouter();
 int end_zynmidirouter();
+//Offline mode => No jack client. Cycles are run by calling jack_process().
+int init_zynmidirouter_offline(jack_nframes_t sample_rate, jack_nframes_t buffer_size);
 
 //-----------------------------------------------------------------------------
 // Data Structures
@@ -76,6 +80,44 @@ struct midi_event_st {
 	enum midi_event_type_enum type;
 	uint8_t chan;
 	uint8_t num;
+	//One-to-many mapping => index+1 of the preset's multimap (0 => none)
+	uint8_t multimap;
+	//Value curve => index+1 of the preset's curve LUT (0 => none)
+	uint8_t curve;
+};
+
+//One-to-many mapping target. Value is scaled linearly to [val_min, val_max]
+//(inverted if val_min>val_max). 2-bytes targets (PC, channel pressure) carry the value.
+struct mf_target_st {
+	uint8_t type;
+	uint8_t chan;
+	uint8_t num;
+	uint8_t val_min;
+	uint8_t val_max;
+	//Value curve => index+1 of the preset's curve LUT (0 => linear)
+	uint8_t curve;
+};
+
+//Value response curves => compiled to 128-entry LUTs (with the value range)
+enum midi_curve_enum {
+	MIDI_CURVE_LINEAR=0,
+	MIDI_CURVE_LOG=1,
+	MIDI_CURVE_EXP=2,
+	MIDI_CURVE_CUSTOM=3
+};
+
+struct mf_curve_st {
+	uint8_t used;
+	uint8_t type;
+	uint8_t val_min;
+	uint8_t val_max;
+};
+
+//Target list => pool[first ... first+n_targets-1] of the multimap table
+struct mf_multimap_st {
+	uint8_t used;
+	uint8_t n_targets;
+	uint16_t first;
 };
 
 struct mf_arrow_st {
@@ -91,26 +133,103 @@ struct mf_clone_st {
 	uint8_t cc[128];
 };
 
+//Keyboard zones => splits & layers of an input channel
+#define MAX_MIDI_ZONES 16
+
+struct mf_zone_st {
+	uint8_t enabled;
+	uint8_t chan_from;
+	uint8_t note_min;
+	uint8_t note_max;
+	uint8_t vel_min;
+	uint8_t vel_max;
+	uint8_t chan_to;
+	int8_t transpose;
+};
+
+//Compiled zones => bitmasks of zone indexes. Double-buffered in the preset.
+struct mf_zone_table_st {
+	struct mf_zone_st zones[MAX_MIDI_ZONES];
+	//Zones of every (channel, note)
+	uint16_t note_mask[16][128];
+	//Zones accepting every velocity
+	uint16_t vel_mask[128];
+	//Zones receiving channel events => one zone per target channel
+	uint16_t chan_mask[16];
+};
+
 static uint8_t default_cc_to_clone[]={ 1, 2, 64, 65, 66, 67, 68 };
 
+//Velocity curves => per-channel LUTs for note-on & note-off (release) velocity.
+//Tables are double-buffered: the inactive buffer is filled and then published.
+enum midi_velocity_curve_enum {
+	MIDI_VELOCITY_NOTE_ON=0,
+	MIDI_VELOCITY_NOTE_OFF=1
+};
+
+struct mf_velocity_curve_st {
+	uint8_t lut[2][128];
+	//Buffer used by the RT thread (-1 => bypass)
+	volatile int active;
+};
+
+//High-resolution controllers => per-channel parser modes
+#define MIDI_HIRES_CC14 1
+#define MIDI_HIRES_NRPN 2
+
+//Aggregated parameter types
+enum midi_hires_param_enum {
+	MIDI_HIRES_PARAM_NONE=0,
+	MIDI_HIRES_PARAM_NRPN=1,
+	MIDI_HIRES_PARAM_RPN=2
+};
+
+struct mf_hires_st {
+	//14-bit values of MSB/LSB controller pairs (0-31 / 32-63)
+	uint16_t ctrl_val[32];
+	//Selected NRPN/RPN parameter & its last 14-bit value
+	uint8_t param_type;
+	uint16_t param_num;
+	uint16_t param_val;
+};
+
 struct midi_filter_st {
 	int tuning_pitchbend;
 	int master_chan;
 	int active_chan;
 	int last_active_chan;
+	//Original channel of the last event moved to the active channel => for controller feedback
+	int active_chan_src;
 	int auto_relmode;
 
-	int transpose[16];
-	struct mf_clone_st clone[16][16];
-	struct midi_event_st event_map[8][16][128];
+	//Active preset => transpose, clone & event mapping config. Swapped by RT thread.
+	struct mf_preset_st *preset;
+
+	//Zones that routed every held note => note-off & key pressure follow the note-on
+	uint16_t zone_note[16][128];
+	//Target (chan << 8 | note) of every held note in every zone, resolved on note-on
+	//=> held notes are released as they were played, even if the zone changed (0xFFFF => none)
+	uint16_t zone_note_target[16][128][MAX_MIDI_ZONES];
+
+	//High-resolution controllers => mode & 14-bit state
+	uint8_t hires_mode[16];
+	struct mf_hires_st hires[16];
+
+	//Velocity curves, applied after event mapping
+	struct mf_velocity_curve_st velocity_curve[16][2];
 
 	uint8_t ctrl_mode[16][128];
 	uint8_t ctrl_relmode_count[16][128];
+	//Controller encodings of input CCs & accumulated 14-bit values
+	uint8_t ctrl_enc[16][128];
+	uint16_t ctrl_enc_step[16][128];
+	uint16_t ctrl_enc_val[16][128];
 
 	uint8_t last_ctrl_val[16][128];
 	uint16_t last_pb_val[16];
 
 	uint8_t note_state[16][128];
+	uint8_t note_preset[16][128];
 };
 struct midi_filter_st midi_filter;
 
@@ -154,9 +273,65 @@ struct midi_event_st *get_midi_filter_event_map(enum midi_event_type_enum type_f
 void del_midi_filter_event_map_st(struct midi_event_st *ev_filter);
 void del_midi_filter_event_map(enum midi_event_type_enum type_from, uint8_t chan_from, uint8_t num_from);
 void reset_midi_filter_event_map();
+//Reverse event map => Source event mapped to a target event (NULL if none)
+struct midi_event_st *get_midi_filter_rev_event_map(enum midi_event_type_enum type_to, uint8_t chan_to, uint8_t num_to);
+
+//One-to-many event mapping => Targets are compiled to a compact list in the preset's
+//pool and replace the event_map arrow of the source event. Return 0 if error.
+#define MAX_MIDI_MULTIMAPS 128
+#define MAX_MIDI_MULTIMAP_TARGETS 16
+#define MIDI_MULTIMAP_POOL_SIZE 1024
+
+int set_midi_filter_event_multimap(enum midi_event_type_enum type_from, uint8_t chan_from, uint8_t num_from, struct mf_target_st *targets, int n_targets);
+int add_midi_filter_event_multimap_target(enum midi_event_type_enum type_from, uint8_t chan_from, uint8_t num_from, enum midi_event_type_enum type_to, uint8_t chan_to, uint8_t num_to, uint8_t val_min, uint8_t val_max);
+//Copy targets => Return number of targets
+int get_midi_filter_event_multimap(enum midi_event_type_enum type_from, uint8_t chan_from, uint8_t num_from, struct mf_target_st *targets, int max_targets);
+int del_midi_filter_event_multimap(enum midi_event_type_enum type_from, uint8_t chan_from, uint8_t num_from);
+void reset_midi_filter_event_multimaps();
+
+//Value range & response curve of a mapping => Applied to the value byte (CC value,
+//velocity, pressure, pitch-bend MSB) after mapping, with a precompiled LUT. Note-on
+//velocity 0 (note-off) is not changed. Return 0 if error.
+#define MAX_MIDI_CURVES 64
+
+int set_midi_filter_event_curve(enum midi_event_type_enum type_from, uint8_t chan_from, uint8_t num_from, int curve, uint8_t val_min, uint8_t val_max);
+int set_midi_filter_event_curve_lut(enum midi_event_type_enum type_from, uint8_t chan_from, uint8_t num_from, uint8_t *lut);
+int del_midi_filter_event_curve(enum midi_event_type_enum type_from, uint8_t chan_from, uint8_t num_from);
+//Return the LUT (NULL if none)
+uint8_t *get_midi_filter_event_curve_lut(enum midi_event_type_enum type_from, uint8_t chan_from, uint8_t num_from);
+//Curve of a one-to-many mapping target => the target's value range is used
+int set_midi_filter_event_multimap_curve(enum midi_event_type_enum type_from, uint8_t chan_from, uint8_t num_from, int i_target, int curve, uint8_t *lut);
+
+//Keyboard zones => a zoned input channel is routed only through its zones (notes
+//outside every zone are dropped) and it's not cloned. Channel events (CC, PB, ...)
+//are sent once to every target channel. Return 0 if error.
+int set_midi_filter_zone(int iz, uint8_t chan_from, uint8_t note_min, uint8_t note_max, uint8_t vel_min, uint8_t vel_max, uint8_t chan_to, int transpose);
+int get_midi_filter_zone(int iz, struct mf_zone_st *zone);
+int del_midi_filter_zone(int iz);
+void reset_midi_filter_zones();
+
+//High-resolution controllers => chan=0xFF for all channels. When enabled, MSB/LSB pairs
+//and NRPN/RPN sequences are aggregated to a single event for the UI (flagged as
+//ZYNMIDI_FLAG_HIRES) and the mapping stage, and expanded again on output.
+//Data increment/decrement (CC 96/97) step the selected parameter's value.
+int set_midi_filter_hires_mode(uint8_t chan, uint8_t mode);
+int get_midi_filter_hires_mode(uint8_t chan);
+//14-bit value of a MSB controller (0-31) => -1 if error
+int get_midi_filter_hires_ctrl_val(uint8_t chan, uint8_t num);
+//Selected NRPN/RPN parameter => Return 14-bit value, -1 if none
+int get_midi_filter_hires_param(uint8_t chan, int *type, int *num);
+
+//Velocity curves => chan=0xFF for all channels. A note-on curve never turns a note-on
+//into a note-off (velocity 0 is only produced from 0). Return 0 if error.
+int set_midi_filter_velocity_curve(uint8_t chan, int vtype, int curve, uint8_t val_min, uint8_t val_max);
+int set_midi_filter_velocity_lut(uint8_t chan, int vtype, uint8_t *lut);
+//Return the active LUT (NULL if bypassed)
+uint8_t *get_midi_filter_velocity_lut(uint8_t chan, int vtype);
+void reset_midi_filter_velocity_curve(uint8_t chan, int vtype);
 
 //MIDI Filter Mapping
 void set_midi_filter_cc_map(uint8_t chan_from, uint8_t cc_from, uint8_t chan_to, uint8_t cc_to);
+int set_midi_filter_cc_curve(uint8_t chan, uint8_t cc, int curve, uint8_t val_min, uint8_t val_max);
 void set_midi_filter_cc_ignore(uint8_t chan, uint8_t cc_from);
 uint8_t get_midi_filter_cc_map(uint8_t chan, uint8_t cc_from);
 void del_midi_filter_cc_map(uint8_t chan, uint8_t cc_from);
@@ -189,6 +364,7 @@ uint8_t get_midi_filter_cc_swap(uint8_t chan, uint8_t num);
 #define FLAG_ZMIP_SWAP 16
 #define FLAG_ZMIP_TRANSPOSE 32
 #define FLAG_ZMIP_TUNING 64
+#define FLAG_ZMIP_PRESET 128
 
 #define ZMOP_MAIN 0
 #define ZMOP_MIDI 1
@@ -199,7 +375,7 @@ uint8_t get_midi_filter_cc_swap(uint8_t chan, uint8_t num);
 #define ZMOP_CH3 6
 #define ZMOP_CH4 7
 #define ZMOP_CH5 8
-#define ZMOP_CH6 8
+#define ZMOP_CH6 9
 #define ZMOP_CH7 10
 #define ZMOP_CH8 11
 #define ZMOP_CH9 12
@@ -222,54 +398,327 @@ uint8_t get_midi_filter_cc_swap(uint8_t chan, uint8_t num);
 
 #define ZMOP_MAIN_FLAGS (FLAG_ZMOP_TUNING)
 
-#define ZMIP_MAIN_FLAGS (FLAG_ZMIP_UI|FLAG_ZMIP_ZYNCODER|FLAG_ZMIP_CLONE|FLAG_ZMIP_FILTER|FLAG_ZMIP_SWAP|FLAG_ZMIP_TRANSPOSE|FLAG_ZMIP_TUNING)
+#define ZMIP_MAIN_FLAGS (FLAG_ZMIP_UI|FLAG_ZMIP_ZYNCODER|FLAG_ZMIP_CLONE|FLAG_ZMIP_FILTER|FLAG_ZMIP_SWAP|FLAG_ZMIP_TRANSPOSE|FLAG_ZMIP_TUNING|FLAG_ZMIP_PRESET)
 #define ZMIP_SEQ_FLAGS (FLAG_ZMIP_UI|FLAG_ZMIP_ZYNCODER)
 #define ZMIP_CTRL_FLAGS (FLAG_ZMIP_UI)
 
+//-----------------------------------------------------------------------------
+// Per-cycle Event Arena
+//-----------------------------------------------------------------------------
+// Events are stored once per cycle in a preallocated, mlocked arena, and the
+// zmops hold indexes to them, so fan-out doesn't copy event data. The arena is
+// reset at the start of every jack_process() cycle.
+//-----------------------------------------------------------------------------
+
+#define MIDI_ARENA_SIZE 8192
+#define ZMOP_MAX_EVENTS 4096
+#define ZMOP_MAX_RT_EVENTS 256
+
+//Realtime lane messages
+#define MIDI_RT_CLOCK 1
+#define MIDI_RT_TRANSPORT 2
+#define MIDI_RT_ALL (MIDI_RT_CLOCK | MIDI_RT_TRANSPORT)
+
+//Status acceptance masks => 1 bit for each status byte, checked before any processing
+#define MIDI_STATUS_MASK_WORDS 8
+#define MIDI_STATUS_ACCEPTED(mask, status) ((mask)[(uint8_t)(status) >> 5] & (1U << ((status) & 0x1F)))
+
+struct zynmidi_event_st {
+	jack_nframes_t time;
+	uint8_t size;
+	uint8_t data[3];
+};
+
+struct midi_arena_st {
+	struct zynmidi_event_st events[MIDI_ARENA_SIZE];
+	int n_events;
+	uint32_t overflows;
+};
+struct midi_arena_st midi_arena;
+
+int init_midi_arena();
+//Add event to arena => Return index (-1 if full). Call from RT thread!
+int midi_arena_add(jack_nframes_t time, uint8_t *data, int size);
+
 struct zmop_st {
 	jack_port_t *jport;
-	uint8_t data[JACK_MIDI_BUFFER_SIZE];
-	int n_data;
+	uint16_t events[ZMOP_MAX_EVENTS];
+	int n_events;
+	//Realtime lane => clock & transport events, written first on equal time
+	uint16_t rt_events[ZMOP_MAX_RT_EVENTS];
+	int n_rt_events;
+	uint8_t rt_mask;
+	uint32_t status_mask[MIDI_STATUS_MASK_WORDS];
 	int midi_channel;
 	int n_connections;
 	uint32_t flags;
 };
 struct zmop_st zmops[MAX_NUM_ZMOPS];
+//Scratch buffer for merging the sorted runs of a zmop's events
+uint16_t zmop_sort_buffer[ZMOP_MAX_EVENTS];
+
+//Channel demultiplexing => Channel events are pushed only to their channel's zmop
+int zmop_chan[16];
+int zmops_nochan[MAX_NUM_ZMOPS];
+int n_zmops_nochan;
 
 int zmop_init(int iz, char *name, int ch, uint32_t flags);
-int zmop_push_data(int iz, jack_midi_event_t ev, int ch);
+int zmops_init_demux();
+int zmop_push_event(int iz, jack_midi_event_t ev, int ch);
+int zmop_push_index(int iz, int ie, int ch);
+int zmop_push_rt_index(int iz, int ie);
+//Realtime lane messages accepted by a zmop => MIDI_RT_* mask
+int zmop_set_rt_mask(int iz, uint8_t mask);
+int zmop_get_rt_mask(int iz);
+//Status bytes accepted by a zmop => All by default
+int zmop_set_status_mask(int iz, uint32_t *mask);
+int zmop_get_status_mask(int iz, uint32_t *mask);
+int zmop_set_status_accept(int iz, uint8_t status_from, uint8_t status_to, int accept);
 int zmop_clear_data(int iz);
 int zmops_clear_data();
 int zmop_set_flags(int iz, uint32_t flags);
 int zoip_has_flag(int iz, uint32_t flag);
 
+#define ZMIP_INJECT_SIZE 512
+
+typedef int (*zmip_process_func)(int iz, jack_nframes_t nframes);
+
 struct zmip_st {
 	jack_port_t *jport;
 	int fwd_zmops[MAX_NUM_ZMOPS];
 	uint32_t flags;
+	uint32_t status_mask[MIDI_STATUS_MASK_WORDS];
+	//Processing function, specialized for the flags
+	zmip_process_func process;
+
+	//Events injected (replay, etc.) for the current cycle, merged by time with jack input
+	struct zynmidi_event_st inject[ZMIP_INJECT_SIZE];
+	int n_inject;
+	int i_inject;
+	int i_jack;
 };
 struct zmip_st zmips[MAX_NUM_ZMIPS];
 
 int zmip_init(int iz, char *name, uint32_t flags);
+int zmip_inject_event(int iz, jack_nframes_t time, uint8_t *data, int size);
 int zmip_set_forward(int izmip, int izmop, int fwd);
 int zmip_set_flags(int iz, uint32_t flags);
 int zmip_has_flag(int iz, uint32_t flag);
+//Status bytes accepted by a zmip => All by default
+int zmip_set_status_mask(int iz, uint32_t *mask);
+int zmip_get_status_mask(int iz, uint32_t *mask);
+int zmip_set_status_accept(int iz, uint8_t status_from, uint8_t status_to, int accept);
+
+//Flag-specialized processing => Generic (runtime flags) version is used for other combinations
+#define ZMIP_PROCESS_FLAGS_MASK (FLAG_ZMIP_UI|FLAG_ZMIP_ZYNCODER|FLAG_ZMIP_CLONE|FLAG_ZMIP_FILTER|FLAG_ZMIP_TRANSPOSE|FLAG_ZMIP_TUNING|FLAG_ZMIP_PRESET)
+
+struct zmip_process_variant_st {
+	uint32_t flags;
+	zmip_process_func process;
+};
+
+int zmip_specialized;
+void zmip_select_process(int iz);
+//Enable/disable flag-specialized processing (for benchmarking)
+void set_zmip_specialized(int enable);
+
+//-----------------------------------------------------------------------------
+// MIDI Router Presets
+//-----------------------------------------------------------------------------
+
+#define MAX_NUM_MIDI_PRESETS 8
+
+//Held notes policy when switching presets
+enum midi_preset_handoff_enum {
+	//Note-off events are cloned, mapped & routed through the preset that routed the note-on
+	MIDI_PRESET_HANDOFF_KEEP=0,
+	//All held notes are released when switching
+	MIDI_PRESET_HANDOFF_ALL_OFF=1
+};
+
+//One-to-many mappings. Double-buffered in the preset => edits compact the
+//inactive table, so the target lists used by the RT thread never move.
+struct mf_multimap_table_st {
+	struct mf_multimap_st multimaps[MAX_MIDI_MULTIMAPS];
+	struct mf_target_st pool[MIDI_MULTIMAP_POOL_SIZE];
+	int n_pool;
+};
+
+struct mf_preset_st {
+	int transpose[16];
+	struct mf_clone_st clone[16][16];
+	struct midi_event_st event_map[8][16][128];
+	//Reverse index of event_map => source event of every target event (NONE_EVENT if none).
+	//Its multimap field is the index+1 of the one-to-many target (0 => single arrow).
+	struct midi_event_st rev_event_map[8][16][128];
+	//One-to-many mappings => the RT thread uses multimap_tables[multimap_table]
+	struct mf_multimap_table_st multimap_tables[2];
+	volatile int multimap_table;
+	//Value curves
+	struct mf_curve_st curves[MAX_MIDI_CURVES];
+	uint8_t curve_luts[MAX_MIDI_CURVES][128];
+	//Inverse of the curve LUTs => for controller feedback
+	uint8_t curve_inv_luts[MAX_MIDI_CURVES][128];
+	//Keyboard zones => the RT thread uses zone_tables[zone_table]
+	struct mf_zone_table_st zone_tables[2];
+	volatile int zone_table;
+	int fwd_zmops[MAX_NUM_ZMIPS][MAX_NUM_ZMOPS];
+};
+struct mf_preset_st midi_presets[MAX_NUM_MIDI_PRESETS];
+
+//MIDI event that triggers a preset switch (chan=-1 => master channel):
+//  + PROG_CHANGE => program number is the preset
+//  + CTRL_CHANGE => value of CC num is the preset
+struct mf_preset_trigger_st {
+	enum midi_event_type_enum type;
+	int chan;
+	uint8_t num;
+};
+struct mf_preset_trigger_st midi_preset_trigger;
+
+int midi_preset_handoff;
+volatile int midi_preset_pending;
+
+int init_midi_presets();
+//Rebuild the reverse event map index of a preset
+void rebuild_rev_event_map(struct mf_preset_st *preset);
+//Compile the zones of a preset to the inactive zone table and publish it
+void compile_midi_zones(struct mf_preset_st *preset, struct mf_zone_st *zones);
+//Active multimap table of a preset
+struct mf_multimap_table_st *get_multimap_table(struct mf_preset_st *preset);
+//Inactive multimap table of a preset, initialized from the active one (or cleared)
+struct mf_multimap_table_st *edit_multimap_table(struct mf_preset_st *preset, int clear);
+//Make an edited multimap table the active one
+void publish_multimap_table(struct mf_preset_st *preset, struct mf_multimap_table_st *mt);
+//Remove a one-to-many target list from an inactive table, compacting the pool
+void free_midi_multimap(struct mf_multimap_table_st *mt, int im);
+//Store the active config in a preset slot => Return 0 if the slot is active or has held notes
+int store_midi_preset(int i);
+int select_midi_preset(int i);
+int get_midi_preset();
+void set_midi_preset_handoff(int policy);
+int get_midi_preset_handoff();
+void set_midi_preset_trigger(enum midi_event_type_enum type, int chan, uint8_t num);
+void reset_midi_preset_trigger();
 
 //-----------------------------------------------------------------------------
 // Jack MIDI Process
 //-----------------------------------------------------------------------------
 
 jack_client_t *jack_client;
+jack_nframes_t jack_sample_rate;
+jack_nframes_t jack_buffer_size;
+//Frame time of the current cycle's first frame
+jack_nframes_t jack_cycle_frame;
 
 int init_jack_midi(char *name);
 int end_jack_midi();
+int init_zynmidi_ports();
+int jack_process_zmip(int iz, jack_nframes_t nframes);
+//Sort zmop event references by time => stable, merging the sorted runs pushed by every source
+void sort_zmop_events(uint16_t *events, int n_events);
+int jack_process_zmop(int iz, jack_nframes_t nframes);
 int jack_process(jack_nframes_t nframes, void *arg);
+//Wait for the end of the RT cycle in progress => before reusing data the RT thread could be reading
+void wait_midi_cycle();
+
+//-----------------------------------------------------------------------------
+// Router State Views => UI
+//-----------------------------------------------------------------------------
+// State arrays are exported by pointer, for zero-copy views from the UI.
+// The RT thread increments "seq" before & after every cycle, so it's odd while
+// the state is being modified. A reader can detect torn reads by checking that
+// "seq" is even and didn't change while it was reading (seqlock).
+// Transpose & clone arrays belong to the preset that is active when requested.
+//-----------------------------------------------------------------------------
+
+struct zynmidi_stats_st {
+	volatile uint32_t seq;
+	uint32_t cycles;
+	uint32_t zmip_events[MAX_NUM_ZMIPS];
+	uint32_t zmop_events[MAX_NUM_ZMOPS];
+	uint32_t ui_overflows;
+};
+struct zynmidi_stats_st zynmidi_stats;
+
+struct midi_filter_snapshot_st {
+	uint32_t seq;
+	int master_chan;
+	int active_chan;
+	int preset;
+	int transpose[16];
+	uint8_t clone[16][16];
+	uint16_t last_pb_val[16];
+	uint8_t last_ctrl_val[16][128];
+	uint8_t note_state[16][128];
+};
+
+struct zynmidi_stats_st *get_zynmidi_stats();
+uint8_t *get_midi_filter_last_ctrl_val_array();
+uint8_t *get_midi_filter_note_state_array();
+uint16_t *get_midi_filter_last_pb_val_array();
+int *get_midi_filter_transpose_array();
+struct mf_clone_st *get_midi_filter_clone_array();
+int get_midi_filter_snapshot(struct midi_filter_snapshot_st *snap);
+
+//-----------------------------------------------------------------------------
+// MIDI Latency Probe
+//-----------------------------------------------------------------------------
+// A tagged SysEx marker (F0 7D 5A seq_msb seq_lsb F7) is sent on a zmop every
+// "interval" and detected on a zmip. The round-trip latency, in frames, is
+// recorded in a linear histogram. With loopback, the zmop is connected to the
+// zmip by jack, so it can run with the dummy driver. Beware of feedback loops
+// if the zmip is routed to the zmop!
+// Stats are updated from the RT thread => use zynmidi_stats.seq for reading.
+//-----------------------------------------------------------------------------
+
+#define MIDI_PROBE_MANUFACTURER_ID 0x7D
+#define MIDI_PROBE_TAG 0x5A
+#define MIDI_PROBE_MSG_SIZE 6
+#define MIDI_PROBE_MAX_PENDING 16
+#define MIDI_PROBE_HIST_SIZE 256
+
+struct midi_probe_stats_st {
+	uint32_t sent;
+	uint32_t received;
+	uint32_t lost;
+	uint32_t min;
+	uint32_t max;
+	uint64_t sum;
+	uint32_t bin_frames;
+	//Last bin counts latencies out of range
+	uint32_t hist[MIDI_PROBE_HIST_SIZE];
+};
+
+struct midi_probe_st {
+	volatile int enabled;
+	int zmop;
+	int zmip;
+	int loopback;
+	jack_nframes_t interval;
+	jack_nframes_t next_frame;
+	uint16_t seq;
+	uint16_t pending_seq[MIDI_PROBE_MAX_PENDING];
+	jack_nframes_t pending_frame[MIDI_PROBE_MAX_PENDING];
+	uint8_t pending[MIDI_PROBE_MAX_PENDING];
+	struct midi_probe_stats_st stats;
+};
+struct midi_probe_st midi_probe;
+
+int start_midi_probe(int izmop, int izmip, int interval_ms, int bin_frames, int loopback);
+int stop_midi_probe();
+void reset_midi_probe_stats();
+struct midi_probe_stats_st *get_midi_probe_stats();
+
+//RT functions
+void midi_probe_send(void *port_buffer);
+int midi_probe_receive(jack_midi_event_t *ev);
 
 //-----------------------------------------------------------------------------
 // MIDI Input Events Buffer Management and Send functions
 //-----------------------------------------------------------------------------
 
-#define ZYNMIDI_BUFFER_SIZE 1024
+#define ZYNMIDI_BUFFER_SIZE 1024 //Must be a power of 2
 
 //-----------------------------------------------------
 // MIDI Internal Input <= UI and internal
@@ -293,6 +742,11 @@ int zynmidi_send_all_notes_off_chan(uint8_t chan);
 
 jack_ringbuffer_t *jack_ring_ctrlfb_buffer;
 int write_ctrlfb_midi_event(uint8_t *event, int event_size);
+//Feedback events are translated through the inverse of the active channel, clone,
+//zones & event mapping applied to main_in, so they reach the controls that drive them.
+//Values are unscaled through the inverse of the target range & curve. 2-bytes
+//targets (PC, channel pressure) are not unscaled.
+int reverse_ctrlfb_event(uint8_t *data, int *size);
 
 int ctrlfb_send_note_off(uint8_t chan, uint8_t note, uint8_t vel);
 int ctrlfb_send_note_on(uint8_t chan, uint8_t note, uint8_t vel);
@@ -304,9 +758,55 @@ int ctrlfb_send_pitchbend_change(uint8_t chan, uint16_t pb);
 // MIDI Internal Ouput Events Buffer => UI
 //-----------------------------------------------------------------------------
 
+// Events are delivered as 16-byte records, with time & source. The packed
+// read_zynmidi() is kept for compatibility: it returns the 3 post-filter bytes
+// and skips the records flagged as ZYNMIDI_FLAG_EXT_ONLY. Aggregated MSB/LSB
+// controllers (ZYNMIDI_FLAG_HIRES) are returned as the plain MSB controller,
+// and aggregated NRPN/RPN are skipped, as they can't be told from CC 99/101.
+// Records from the RT thread (write_zynmidi_ext) and from other threads
+// (write_zynmidi_src => switch & encoder ISRs, UI) go to separate rings, so
+// the RT ring keeps a single writer. The reader merges them by time.
+// Encoder values flagged as ZYNMIDI_FLAG_EXT_ONLY are coalesced per encoder
+// and only delivered by read_zynmidi_ext(), with the time they are read.
+//-----------------------------------------------------------------------------
+
+//Source => type (2 MSB) + index (6 LSB)
+#define ZYNMIDI_SRC_ZMIP 0x00
+#define ZYNMIDI_SRC_SWITCH 0x40
+#define ZYNMIDI_SRC_ENCODER 0x80
+#define ZYNMIDI_SRC_INTERNAL 0xC0
+#define ZYNMIDI_SRC_TYPE_MASK 0xC0
+#define ZYNMIDI_SRC_INDEX_MASK 0x3F
+
+//Record flags
+#define ZYNMIDI_FLAG_LEARN 1
+#define ZYNMIDI_FLAG_MASTER 2
+#define ZYNMIDI_FLAG_EXT_ONLY 4
+//Aggregated 14-bit controller => data={0xB0|chan, num, MSB}, where num is the MSB
+//controller, or 99 (NRPN) / 101 (RPN). orig={LSB, param MSB, param LSB}.
+#define ZYNMIDI_FLAG_HIRES 8
+
+#define ZYNMIDI_PACK(b0,b1,b2) ((((uint32_t)(b0)) << 16) | (((uint32_t)(b1)) << 8) | (uint32_t)(b2))
+
+struct zynmidi_ui_event_st {
+	//Monotonic time in microseconds (jack time for events from zmips)
+	uint64_t time_us;
+	uint8_t src;
+	uint8_t flags;
+	//Bytes as received & after filtering
+	uint8_t orig[3];
+	uint8_t data[3];
+};
+
 int init_zynmidi_buffer();
 int write_zynmidi(uint32_t ev);
+int write_zynmidi_src(uint8_t src, uint8_t flags, uint32_t ev);
+//RT thread only
+int write_zynmidi_ext(uint64_t time_us, uint8_t src, uint8_t flags, const uint8_t *orig, const uint8_t *data);
 uint32_t read_zynmidi();
+int read_zynmidi_ext(struct zynmidi_ui_event_st *ev);
+uint64_t get_zynmidi_time_us();
+uint64_t zynmidi_frame_to_us(jack_nframes_t frame);
 
 int write_zynmidi_ccontrol_change(uint8_t chan, uint8_t num, uint8_t val);
 int write_zynmidi_note_on(uint8_t chan, uint8_t num, uint8_t val);
@@ -320,5 +820,30 @@ int write_zynmidi_program_change(uint8_t chan, uint8_t num);
 int midi_ctrl_automode;
 void set_midi_ctrl_automode(int mcam);
 
+//Controller encodings => relative values are decoded with a delta table and
+//accumulated to a 14-bit value. AUTO uses the auto-mode heuristic (if enabled).
+enum midi_ctrl_enc_enum {
+	MIDI_CTRL_ENC_AUTO=0,
+	MIDI_CTRL_ENC_ABSOLUTE=1,
+	//64 => 0, 65 => +1, 63 => -1
+	MIDI_CTRL_ENC_OFFSET=2,
+	//1 => +1, 127 => -1
+	MIDI_CTRL_ENC_TWOS=3,
+	//1 => +1, 65 => -1
+	MIDI_CTRL_ENC_SIGNMAG=4,
+	//1-63 => +1, 64-127 => -1
+	MIDI_CTRL_ENC_INCDEC=5
+};
+#define MIDI_CTRL_ENC_NUM 6
+//Default step => one 7-bit value per tick
+#define MIDI_CTRL_ENC_STEP 128
+
+int8_t midi_ctrl_enc_delta[MIDI_CTRL_ENC_NUM][128];
+void init_midi_ctrl_enc_delta();
+
+//chan/num=0xFF for all. step is in 14-bit units (0 => default). Return 0 if error.
+int set_midi_filter_ctrl_encoding(uint8_t chan, uint8_t num, int enc, int step);
+int get_midi_filter_ctrl_encoding(uint8_t chan, uint8_t num);
+
 
 //-----------------------------------------------------------------------------
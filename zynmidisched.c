@@ -0,0 +1,296 @@
+/*
+ * ******************************************************************
+ * ZYNTHIAN PROJECT: ZynMidiRouter Library
+ *
+ * MIDI Scheduler: Future-dated events, released at exact frame offsets
+ *
+ * Copyright (C) 2015-2018 Fernando Moyano <jofemodo@zynthian.org>
+ *
+ * ******************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * For a full copy of the GNU General Public License see the LICENSE.txt file.
+ *
+ * ******************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <jack/jack.h>
+#include <jack/ringbuffer.h>
+
+#include "zynmidirouter.h"
+#include "zynmidistatus.h"
+#include "zynmidisched.h"
+
+//-----------------------------------------------------------------------------
+// Timing Wheel => RT thread only
+//-----------------------------------------------------------------------------
+
+#define MIDI_SCHED_SLOT_MASK (MIDI_SCHED_NUM_SLOTS-1)
+
+struct midi_sched_node_st {
+	struct midi_sched_event_st ev;
+	//Arrival order => ties between events with the same frame
+	uint32_t seq;
+	int next;
+};
+
+struct midi_sched_st {
+	struct midi_sched_node_st nodes[MIDI_SCHED_POOL_SIZE];
+	int free_node;
+	//FIFO list of nodes by slot
+	int slot_head[MIDI_SCHED_NUM_SLOTS];
+	int slot_tail[MIDI_SCHED_NUM_SLOTS];
+	//Events up to this frame have been released
+	jack_nframes_t scan_frame;
+	int started;
+	uint32_t seq;
+	//Due events in the current cycle
+	int due[ZMIP_INJECT_SIZE];
+};
+struct midi_sched_st midi_sched;
+
+jack_ringbuffer_t *midi_sched_ring;
+//Ring-buffer writers => the jack ring-buffer is single-producer
+pthread_mutex_t midi_sched_write_mutex=PTHREAD_MUTEX_INITIALIZER;
+volatile int midi_sched_num_events;
+volatile uint32_t midi_sched_dropped;
+
+void clear_midi_sched_wheel() {
+	int i;
+	for (i=0;i<MIDI_SCHED_POOL_SIZE;i++) midi_sched.nodes[i].next=i+1;
+	midi_sched.nodes[MIDI_SCHED_POOL_SIZE-1].next=-1;
+	midi_sched.free_node=0;
+	for (i=0;i<MIDI_SCHED_NUM_SLOTS;i++) {
+		midi_sched.slot_head[i]=-1;
+		midi_sched.slot_tail[i]=-1;
+	}
+	midi_sched_num_events=0;
+}
+
+int init_midi_sched() {
+	clear_midi_sched_wheel();
+	midi_sched.started=0;
+	midi_sched.seq=0;
+	midi_sched_dropped=0;
+	midi_sched_ring=jack_ringbuffer_create(MIDI_SCHED_RING_SIZE);
+	// lock the buffer into memory, this is *NOT* realtime safe, do it before using the buffer!
+	if (jack_ringbuffer_mlock(midi_sched_ring)) {
+		fprintf (stderr, "ZynMidiRouter: Error locking memory for MIDI scheduler ring-buffer.\n");
+		return 0;
+	}
+	return 1;
+}
+
+int end_midi_sched() {
+	jack_ringbuffer_free(midi_sched_ring);
+	midi_sched_ring=NULL;
+	return 1;
+}
+
+//-----------------------------------------------------------------------------
+// Schedule API => any non-RT thread
+//-----------------------------------------------------------------------------
+
+int midi_sched_write(struct midi_sched_event_st *evs, int n) {
+	size_t size=n*sizeof(struct midi_sched_event_st);
+	pthread_mutex_lock(&midi_sched_write_mutex);
+	if (jack_ringbuffer_write_space(midi_sched_ring)<size) {
+		pthread_mutex_unlock(&midi_sched_write_mutex);
+		fprintf (stderr, "ZynMidiRouter: Error writing MIDI scheduler ring-buffer: FULL\n");
+		return 0;
+	}
+	jack_ringbuffer_write(midi_sched_ring, (char *)evs, size);
+	pthread_mutex_unlock(&midi_sched_write_mutex);
+	return 1;
+}
+
+int midi_sched_set_event(struct midi_sched_event_st *ev, int iz, jack_nframes_t frame, uint8_t *data, int size) {
+	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
+		fprintf (stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+		return 0;
+	}
+	if (size<1 || size>3 || !(data[0] & 0x80) || MIDI_STATUS_SIZE(data[0])!=size) {
+		fprintf (stderr, "ZynMidiRouter: Bad MIDI event for scheduling (%x, size %d).\n", data[0], size);
+		return 0;
+	}
+	memset(ev, 0, sizeof(struct midi_sched_event_st));
+	ev->frame=frame;
+	ev->zmip=iz;
+	ev->size=size;
+	memcpy(ev->data, data, size);
+	return 1;
+}
+
+jack_nframes_t get_midi_sched_frame() {
+	if (jack_client) return jack_frame_time(jack_client);
+	return jack_cycle_frame;
+}
+
+jack_nframes_t midi_sched_delay_frame(uint32_t delay_us) {
+	return get_midi_sched_frame()+(jack_nframes_t)((uint64_t)delay_us*jack_sample_rate/1000000);
+}
+
+int schedule_midi_event(int iz, jack_nframes_t frame, uint8_t *data, int size) {
+	struct midi_sched_event_st ev;
+	if (!midi_sched_set_event(&ev, iz, frame, data, size)) return 0;
+	return midi_sched_write(&ev, 1);
+}
+
+int schedule_midi_event_delay(int iz, uint32_t delay_us, uint8_t *data, int size) {
+	return schedule_midi_event(iz, midi_sched_delay_frame(delay_us), data, size);
+}
+
+int schedule_midi_note(int iz, uint8_t chan, uint8_t note, uint8_t vel, uint32_t delay_us, uint32_t duration_us) {
+	if (chan>15 || note>127 || vel<1 || vel>127) {
+		fprintf (stderr, "ZynMidiRouter: Bad note for scheduling (chan %d, note %d, vel %d).\n", chan, note, vel);
+		return 0;
+	}
+	uint8_t note_on[3]={ (NOTE_ON<<4) | chan, note, vel };
+	uint8_t note_off[3]={ (NOTE_OFF<<4) | chan, note, 0 };
+	jack_nframes_t frame=midi_sched_delay_frame(delay_us);
+	//Both events in a single write => note-off is never scheduled alone
+	struct midi_sched_event_st evs[2];
+	if (!midi_sched_set_event(evs, iz, frame, note_on, 3)) return 0;
+	if (!midi_sched_set_event(evs+1, iz, frame+(jack_nframes_t)((uint64_t)duration_us*jack_sample_rate/1000000), note_off, 3)) return 0;
+	return midi_sched_write(evs, 2);
+}
+
+int clear_midi_schedule() {
+	struct midi_sched_event_st ev;
+	memset(&ev, 0, sizeof(ev));
+	return midi_sched_write(&ev, 1);
+}
+
+int get_midi_sched_num_events() {
+	return midi_sched_num_events;
+}
+
+uint32_t get_midi_sched_dropped() {
+	return midi_sched_dropped;
+}
+
+//-----------------------------------------------------------------------------
+// RT processing
+//-----------------------------------------------------------------------------
+
+void add_midi_sched_node(struct midi_sched_event_st *ev) {
+	struct midi_sched_st *sched=&midi_sched;
+	int in=sched->free_node;
+	if (in<0) {
+		midi_sched_dropped++;
+		return;
+	}
+	struct midi_sched_node_st *node=sched->nodes+in;
+	sched->free_node=node->next;
+	node->ev=*ev;
+	node->seq=sched->seq++;
+	node->next=-1;
+	//Late events => into the first slot to scan
+	jack_nframes_t frame=ev->frame;
+	if ((int32_t)(frame-sched->scan_frame)<0) frame=sched->scan_frame;
+	int is=(frame>>MIDI_SCHED_SLOT_BITS) & MIDI_SCHED_SLOT_MASK;
+	if (sched->slot_tail[is]<0) sched->slot_head[is]=in;
+	else sched->nodes[sched->slot_tail[is]].next=in;
+	sched->slot_tail[is]=in;
+	midi_sched_num_events++;
+}
+
+//Frame offset in the current cycle => late events at the first frame
+static inline jack_nframes_t midi_sched_offset(struct midi_sched_node_st *node) {
+	int32_t offset=(int32_t)(node->ev.frame-jack_cycle_frame);
+	return (offset<0) ? 0 : offset;
+}
+
+void inject_midi_sched_events(jack_nframes_t nframes) {
+	struct midi_sched_st *sched=&midi_sched;
+	jack_nframes_t end_frame=jack_cycle_frame+nframes;
+	int i, j;
+
+	//Frame time restarted or moved backwards => scan from the current cycle
+	if (!sched->started || (int32_t)(jack_cycle_frame-sched->scan_frame)<0) {
+		sched->scan_frame=jack_cycle_frame;
+		sched->started=1;
+	}
+
+	//Move requests from ring-buffer to the wheel
+	struct midi_sched_event_st ev;
+	while (jack_ringbuffer_read_space(midi_sched_ring)>=sizeof(ev)) {
+		jack_ringbuffer_read(midi_sched_ring, (char *)&ev, sizeof(ev));
+		if (ev.size==0) clear_midi_sched_wheel();
+		else add_midi_sched_node(&ev);
+	}
+	if (midi_sched_num_events==0) {
+		sched->scan_frame=end_frame;
+		return;
+	}
+
+	//Release due events from the slots covering the cycle (& frames skipped since last scan)
+	uint32_t slot=sched->scan_frame>>MIDI_SCHED_SLOT_BITS;
+	uint32_t n_slots=((end_frame-1)>>MIDI_SCHED_SLOT_BITS)-slot+1;
+	if (n_slots>MIDI_SCHED_NUM_SLOTS) n_slots=MIDI_SCHED_NUM_SLOTS;
+	int n_due=0;
+	sched->scan_frame=end_frame;
+	for (i=0;i<n_slots;i++) {
+		int is=(slot+i) & MIDI_SCHED_SLOT_MASK;
+		int prev=-1;
+		int in=sched->slot_head[is];
+		while (in>=0) {
+			struct midi_sched_node_st *node=sched->nodes+in;
+			int next=node->next;
+			if ((int32_t)(node->ev.frame-end_frame)<0) {
+				//Too many due events => continue from this slot in next cycle
+				if (n_due>=ZMIP_INJECT_SIZE) {
+					sched->scan_frame=(slot+i)<<MIDI_SCHED_SLOT_BITS;
+					break;
+				}
+				sched->due[n_due++]=in;
+				if (prev<0) sched->slot_head[is]=next;
+				else sched->nodes[prev].next=next;
+				if (sched->slot_tail[is]==in) sched->slot_tail[is]=prev;
+			}
+			else prev=in;
+			in=next;
+		}
+		if (in>=0) break;
+	}
+
+	//Sort by frame offset & arrival order
+	for (i=1;i<n_due;i++) {
+		int in=sched->due[i];
+		jack_nframes_t offset=midi_sched_offset(sched->nodes+in);
+		uint32_t seq=sched->nodes[in].seq;
+		for (j=i;j>0;j--) {
+			struct midi_sched_node_st *pnode=sched->nodes+sched->due[j-1];
+			jack_nframes_t poffset=midi_sched_offset(pnode);
+			if (poffset<offset || (poffset==offset && (int32_t)(pnode->seq-seq)<0)) break;
+			sched->due[j]=sched->due[j-1];
+		}
+		sched->due[j]=in;
+	}
+
+	//Inject & free nodes
+	for (i=0;i<n_due;i++) {
+		int in=sched->due[i];
+		struct midi_sched_node_st *node=sched->nodes+in;
+		if (!zmip_inject_event(node->ev.zmip, midi_sched_offset(node), node->ev.data, node->ev.size)) midi_sched_dropped++;
+		node->next=sched->free_node;
+		sched->free_node=in;
+	}
+	midi_sched_num_events-=n_due;
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,76 @@
+/*
+ * ******************************************************************
+ * ZYNTHIAN PROJECT: ZynMidiRouter Library
+ *
+ * MIDI Scheduler: Future-dated events, released at exact frame offsets
+ *
+ * Copyright (C) 2015-2018 Fernando Moyano <jofemodo@zynthian.org>
+ *
+ * ******************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * For a full copy of the GNU General Public License see the LICENSE.txt file.
+ *
+ * ******************************************************************
+ */
+
+#include <stdint.h>
+#include <jack/jack.h>
+
+//-----------------------------------------------------------------------------
+// MIDI Event Scheduler
+//-----------------------------------------------------------------------------
+//	+ Any non-RT thread can schedule events for an absolute jack frame time
+//	  or with a delay. Requests go through a ring-buffer to the RT thread.
+//	  It has a single writer => scheduling threads are serialized by a mutex.
+//	+ The RT thread keeps them in a hashed timing wheel => slots of a fixed
+//	  number of frames, each one holding a FIFO list of nodes from a
+//	  preallocated pool. Events far in the future wait for their round.
+//	+ Due events are injected into their zmip at their exact frame offset,
+//	  so they run through the router like live input. Late events are
+//	  injected at the cycle's first frame.
+//-----------------------------------------------------------------------------
+
+#define MIDI_SCHED_RING_SIZE 8192
+#define MIDI_SCHED_POOL_SIZE 2048
+//Wheel => 512 slots of 128 frames (~1.4 seconds @ 48KHz per round)
+#define MIDI_SCHED_SLOT_BITS 7
+#define MIDI_SCHED_NUM_SLOTS 512
+
+struct midi_sched_event_st {
+	jack_nframes_t frame;
+	uint8_t zmip;
+	//0 => clear all scheduled events
+	uint8_t size;
+	uint8_t data[3];
+};
+
+int init_midi_sched();
+int end_midi_sched();
+
+//Schedule an event to be injected into a zmip (ZMIP_STEP, ZMIP_SEQ, ...). Return 0 if error
+int schedule_midi_event(int iz, jack_nframes_t frame, uint8_t *data, int size);
+int schedule_midi_event_delay(int iz, uint32_t delay_us, uint8_t *data, int size);
+//Note-on now (or after delay) & note-off after duration
+int schedule_midi_note(int iz, uint8_t chan, uint8_t note, uint8_t vel, uint32_t delay_us, uint32_t duration_us);
+//Drop all pending events => Events scheduled after this call are kept
+int clear_midi_schedule();
+
+//Current jack frame time => for computing absolute frame times
+jack_nframes_t get_midi_sched_frame();
+int get_midi_sched_num_events();
+uint32_t get_midi_sched_dropped();
+
+//RT function => Called from jack process cycle, before zmips processing
+void inject_midi_sched_events(jack_nframes_t nframes);
+
+//-----------------------------------------------------------------------------
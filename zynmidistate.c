@@ -0,0 +1,234 @@
+/*
+ * ******************************************************************
+ * ZYNTHIAN PROJECT: ZynMidiRouter Library
+ * 
+ * State export: Controller & note state in shared memory
+ * 
+ * Copyright (C) 2015-2018 Fernando Moyano <jofemodo@zynthian.org>
+ *
+ * ******************************************************************
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * For a full copy of the GNU General Public License see the LICENSE.txt file.
+ * 
+ * ******************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "zynmidirouter.h"
+#include "zynmidistate.h"
+
+//-----------------------------------------------------------------------------
+// Producer
+//-----------------------------------------------------------------------------
+
+struct zynmidi_state_st *zynmidi_state=NULL;
+int zynmidi_state_n_encoders=0;
+int zynmidi_state_n_switches=0;
+
+int init_zynmidi_state() {
+	shm_unlink(ZYNMIDI_STATE_SHM_NAME);
+	int fd=shm_open(ZYNMIDI_STATE_SHM_NAME, O_CREAT|O_EXCL|O_RDWR, 0644);
+	if (fd<0) {
+		fprintf (stderr, "ZynMidiRouter: Can't create state shared memory (%s).\n", strerror(errno));
+		return 0;
+	}
+	if (ftruncate(fd, sizeof(struct zynmidi_state_st))) {
+		fprintf (stderr, "ZynMidiRouter: Can't size state shared memory.\n");
+		close(fd);
+		shm_unlink(ZYNMIDI_STATE_SHM_NAME);
+		return 0;
+	}
+	struct zynmidi_state_st *state=mmap(NULL, sizeof(struct zynmidi_state_st), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (state==MAP_FAILED) {
+		fprintf (stderr, "ZynMidiRouter: Can't map state shared memory.\n");
+		shm_unlink(ZYNMIDI_STATE_SHM_NAME);
+		return 0;
+	}
+	if (mlock(state, sizeof(struct zynmidi_state_st))) {
+		fprintf (stderr, "ZynMidiRouter: Error locking memory for exported state.\n");
+	}
+	//Segment is zero-filled => pitch-bend rest value must be published on first cycle
+	state->version=ZYNMIDI_STATE_VERSION;
+	//Encoders & switches beyond the exported arrays are not published
+	zynmidi_state_n_encoders=get_num_zyncoders();
+	if (zynmidi_state_n_encoders>ZYNMIDI_STATE_MAX_ENCODERS) zynmidi_state_n_encoders=ZYNMIDI_STATE_MAX_ENCODERS;
+	zynmidi_state_n_switches=get_num_zynswitches();
+	if (zynmidi_state_n_switches>ZYNMIDI_STATE_MAX_SWITCHES) zynmidi_state_n_switches=ZYNMIDI_STATE_MAX_SWITCHES;
+	state->data.n_encoders=zynmidi_state_n_encoders;
+	state->data.n_switches=zynmidi_state_n_switches;
+	__atomic_store_n(&state->magic, ZYNMIDI_STATE_MAGIC, __ATOMIC_RELEASE);
+	zynmidi_state=state;
+	return 1;
+}
+
+int end_zynmidi_state() {
+	struct zynmidi_state_st *state=zynmidi_state;
+	if (!state) return 0;
+	zynmidi_state=NULL;
+	munmap(state, sizeof(struct zynmidi_state_st));
+	shm_unlink(ZYNMIDI_STATE_SHM_NAME);
+	return 1;
+}
+
+//Copy the changed bytes of a 128 values row & set the dirty bits
+static inline void publish_row(uint8_t *dst, const uint8_t *src, uint32_t *dirty) {
+	int i;
+	for (i=0;i<128;i++) {
+		uint8_t v=src[i];
+		if (dst[i]!=v) {
+			dst[i]=v;
+			dirty[i>>5]|=1<<(i & 0x1F);
+		}
+	}
+}
+
+void publish_zynmidi_state() {
+	struct zynmidi_state_st *state=zynmidi_state;
+	if (!state) return;
+	struct zynmidi_state_data_st *data=&state->data;
+	uint32_t ctrl_rows=0, note_rows=0;
+	int pb=0, enc=0, sw=0;
+	int i;
+
+	//Look for changes, without touching the segment
+	for (i=0;i<16;i++) {
+		if (memcmp(data->last_ctrl_val[i], midi_filter.last_ctrl_val[i], 128)) ctrl_rows|=1<<i;
+		if (memcmp(data->note_state[i], midi_filter.note_state[i], 128)) note_rows|=1<<i;
+	}
+	pb=memcmp(data->last_pb_val, midi_filter.last_pb_val, sizeof(data->last_pb_val));
+	for (i=0;i<zynmidi_state_n_encoders && !enc;i++) enc=(data->encoder_value[i]!=get_value_zyncoder(i));
+	for (i=0;i<zynmidi_state_n_switches && !sw;i++) sw=(data->switch_status[i]!=get_status_zynswitch(i));
+	if (!ctrl_rows && !note_rows && !pb && !enc && !sw) return;
+
+	//Begin update => seq is odd
+	state->seq++;
+	__sync_synchronize();
+
+	uint32_t gen=++data->gen;
+	memset(data->ctrl_dirty, 0, sizeof(data->ctrl_dirty));
+	memset(data->note_dirty, 0, sizeof(data->note_dirty));
+	data->pb_dirty=0;
+	data->encoder_dirty=0;
+	memset(data->switch_dirty, 0, sizeof(data->switch_dirty));
+
+	for (i=0;i<16;i++) {
+		if (ctrl_rows & (1<<i)) {
+			publish_row(data->last_ctrl_val[i], midi_filter.last_ctrl_val[i], data->ctrl_dirty[i]);
+			data->ctrl_gen[i]=gen;
+		}
+		if (note_rows & (1<<i)) {
+			publish_row(data->note_state[i], midi_filter.note_state[i], data->note_dirty[i]);
+			data->note_gen[i]=gen;
+		}
+	}
+	if (pb) {
+		for (i=0;i<16;i++) {
+			uint16_t v=midi_filter.last_pb_val[i];
+			if (data->last_pb_val[i]!=v) {
+				data->last_pb_val[i]=v;
+				data->pb_dirty|=1<<i;
+			}
+		}
+		data->pb_gen=gen;
+	}
+	if (enc) {
+		for (i=0;i<zynmidi_state_n_encoders;i++) {
+			uint32_t v=get_value_zyncoder(i);
+			if (data->encoder_value[i]!=v) {
+				data->encoder_value[i]=v;
+				data->encoder_dirty|=1<<i;
+			}
+		}
+		data->encoder_gen=gen;
+	}
+	if (sw) {
+		for (i=0;i<zynmidi_state_n_switches;i++) {
+			uint8_t v=get_status_zynswitch(i);
+			if (data->switch_status[i]!=v) {
+				data->switch_status[i]=v;
+				data->switch_dirty[i>>5]|=1<<(i & 0x1F);
+			}
+		}
+		data->switch_gen=gen;
+	}
+
+	//End update => seq is even
+	__sync_synchronize();
+	state->seq++;
+}
+
+//-----------------------------------------------------------------------------
+// Consumers
+//-----------------------------------------------------------------------------
+
+struct zynmidi_state_st *zynmidi_state_attach() {
+	int fd=shm_open(ZYNMIDI_STATE_SHM_NAME, O_RDONLY, 0);
+	if (fd<0) {
+		fprintf (stderr, "ZynMidiRouter: Can't open state shared memory (%s).\n", strerror(errno));
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size<sizeof(struct zynmidi_state_st)) {
+		fprintf (stderr, "ZynMidiRouter: State shared memory has wrong size.\n");
+		close(fd);
+		return NULL;
+	}
+	struct zynmidi_state_st *state=mmap(NULL, sizeof(struct zynmidi_state_st), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (state==MAP_FAILED) {
+		fprintf (stderr, "ZynMidiRouter: Can't map state shared memory.\n");
+		return NULL;
+	}
+	if (__atomic_load_n(&state->magic, __ATOMIC_ACQUIRE)!=ZYNMIDI_STATE_MAGIC || state->version!=ZYNMIDI_STATE_VERSION) {
+		fprintf (stderr, "ZynMidiRouter: State shared memory is not valid.\n");
+		munmap(state, sizeof(struct zynmidi_state_st));
+		return NULL;
+	}
+	return state;
+}
+
+int zynmidi_state_detach(struct zynmidi_state_st *state) {
+	if (!state) return 0;
+	munmap(state, sizeof(struct zynmidi_state_st));
+	return 1;
+}
+
+int get_zynmidi_state_snapshot(struct zynmidi_state_st *state, struct zynmidi_state_data_st *snap) {
+	if (!state) return 0;
+	int retries;
+	for (retries=0;retries<1000;retries++) {
+		uint32_t seq=state->seq;
+		if (seq & 1) {
+			usleep(100);
+			continue;
+		}
+		__sync_synchronize();
+		memcpy(snap, (const void *)&state->data, sizeof(struct zynmidi_state_data_st));
+		__sync_synchronize();
+		if (state->seq==seq) return 1;
+	}
+	fprintf (stderr, "ZynMidiRouter: Can't get a consistent snapshot of the exported state!\n");
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
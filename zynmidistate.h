@@ -0,0 +1,101 @@
+/*
+ * ******************************************************************
+ * ZYNTHIAN PROJECT: ZynMidiRouter Library
+ * 
+ * State export: Controller & note state in shared memory
+ * 
+ * Copyright (C) 2015-2018 Fernando Moyano <jofemodo@zynthian.org>
+ *
+ * ******************************************************************
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * For a full copy of the GNU General Public License see the LICENSE.txt file.
+ * 
+ * ******************************************************************
+ */
+
+#include <stdint.h>
+
+//-----------------------------------------------------------------------------
+// State Export
+//-----------------------------------------------------------------------------
+//	+ At the end of each jack cycle, the RT thread compares the MIDI filter
+//	  state (CC, pitch-bend & note arrays), the encoder values and the switch
+//	  states with the exported copy, and publishes the changes to a POSIX
+//	  shared memory segment. Cycles without changes don't touch it.
+//	+ Each publication increments "gen". The dirty bitmaps flag the values
+//	  changed by the last publication, and the *_gen fields record the last
+//	  publication changing each channel/array, so readers that missed some
+//	  publications know which parts to reload.
+//	+ "seq" is a seqlock => odd while publishing. Readers copy the data and
+//	  retry if seq changed (see get_zynmidi_state_snapshot).
+//-----------------------------------------------------------------------------
+
+#define ZYNMIDI_STATE_SHM_NAME "/zynmidi_state"
+#define ZYNMIDI_STATE_MAGIC 0x5A535453
+#define ZYNMIDI_STATE_VERSION 1
+#define ZYNMIDI_STATE_MAX_ENCODERS 32
+#define ZYNMIDI_STATE_MAX_SWITCHES 64
+
+struct zynmidi_state_data_st {
+	uint32_t gen;
+	uint32_t n_encoders;
+	uint32_t n_switches;
+	//Generation of the last change
+	uint32_t ctrl_gen[16];
+	uint32_t note_gen[16];
+	uint32_t pb_gen;
+	uint32_t encoder_gen;
+	uint32_t switch_gen;
+	//Changed by the last generation => bit N of [i][N/32]
+	uint32_t ctrl_dirty[16][4];
+	uint32_t note_dirty[16][4];
+	uint32_t pb_dirty;
+	uint32_t encoder_dirty;
+	uint32_t switch_dirty[ZYNMIDI_STATE_MAX_SWITCHES/32];
+	//State
+	uint16_t last_pb_val[16];
+	uint8_t last_ctrl_val[16][128];
+	uint8_t note_state[16][128];
+	uint32_t encoder_value[ZYNMIDI_STATE_MAX_ENCODERS];
+	uint8_t switch_status[ZYNMIDI_STATE_MAX_SWITCHES];
+};
+
+struct zynmidi_state_st {
+	uint32_t magic;
+	uint32_t version;
+	volatile uint32_t seq;
+	struct zynmidi_state_data_st data;
+};
+
+//Encoder & switch values => Provided by zyncoder.c or zyncoder_i2c.c,
+//so the exported state doesn't depend on their struct layouts
+int get_num_zyncoders();
+unsigned int get_value_zyncoder(uint8_t i);
+int get_num_zynswitches();
+unsigned int get_status_zynswitch(uint8_t i);
+
+//Producer side => Called from init_zynmidirouter / end_zynmidirouter
+int init_zynmidi_state();
+int end_zynmidi_state();
+
+//RT function => Called at the end of the jack process cycle
+void publish_zynmidi_state();
+
+//Consumer side => Map the segment read-only (NULL if error)
+struct zynmidi_state_st *zynmidi_state_attach();
+int zynmidi_state_detach(struct zynmidi_state_st *state);
+
+//Get a consistent copy of the state data => Return 0 if the writer keeps it busy
+int get_zynmidi_state_snapshot(struct zynmidi_state_st *state, struct zynmidi_state_data_st *snap);
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,62 @@
+/*
+ * ******************************************************************
+ * ZYNTHIAN PROJECT: ZynMidiRouter Library
+ * 
+ * MIDI status byte table: message length, class & handler
+ * 
+ * Copyright (C) 2015-2018 Fernando Moyano <jofemodo@zynthian.org>
+ *
+ * ******************************************************************
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * For a full copy of the GNU General Public License see the LICENSE.txt file.
+ * 
+ * ******************************************************************
+ */
+
+#include "zynmidistatus.h"
+
+//-----------------------------------------------------------------------------
+// MIDI Status Table
+//-----------------------------------------------------------------------------
+
+#define ST(size, class, channel, handler, num_pos, val_pos) { size, class, channel, handler, num_pos, val_pos }
+
+const struct midi_status_st midi_status_table[256]={
+	[0x00 ... 0x7F]=ST(0, MIDI_CLASS_DATA, 0, MIDI_HANDLER_NONE, 0, 0),
+	//Channel messages
+	[0x80 ... 0x8F]=ST(3, MIDI_CLASS_CHANNEL, 1, MIDI_HANDLER_NOTE_OFF, 1, 2),
+	[0x90 ... 0x9F]=ST(3, MIDI_CLASS_CHANNEL, 1, MIDI_HANDLER_NOTE_ON, 1, 2),
+	[0xA0 ... 0xAF]=ST(3, MIDI_CLASS_CHANNEL, 1, MIDI_HANDLER_KEY_PRESS, 1, 2),
+	[0xB0 ... 0xBF]=ST(3, MIDI_CLASS_CHANNEL, 1, MIDI_HANDLER_CTRL_CHANGE, 1, 2),
+	[0xC0 ... 0xCF]=ST(2, MIDI_CLASS_CHANNEL, 1, MIDI_HANDLER_PROG_CHANGE, 1, 0),
+	[0xD0 ... 0xDF]=ST(2, MIDI_CLASS_CHANNEL, 1, MIDI_HANDLER_CHAN_PRESS, 0, 1),
+	[0xE0 ... 0xEF]=ST(3, MIDI_CLASS_CHANNEL, 1, MIDI_HANDLER_PITCH_BENDING, 0, 2),
+	//System common messages
+	[0xF0]=ST(0, MIDI_CLASS_SYSEX, 0, MIDI_HANDLER_SYSEX, 0, 0),
+	[0xF1]=ST(2, MIDI_CLASS_COMMON, 0, MIDI_HANDLER_SYSTEM, 1, 0),
+	[0xF2]=ST(3, MIDI_CLASS_COMMON, 0, MIDI_HANDLER_SYSTEM, 1, 2),
+	[0xF3]=ST(2, MIDI_CLASS_COMMON, 0, MIDI_HANDLER_SYSTEM, 1, 0),
+	[0xF4]=ST(1, MIDI_CLASS_UNDEFINED, 0, MIDI_HANDLER_SYSTEM, 0, 0),
+	[0xF5]=ST(1, MIDI_CLASS_UNDEFINED, 0, MIDI_HANDLER_SYSTEM, 0, 0),
+	[0xF6]=ST(1, MIDI_CLASS_COMMON, 0, MIDI_HANDLER_SYSTEM, 0, 0),
+	[0xF7]=ST(0, MIDI_CLASS_SYSEX, 0, MIDI_HANDLER_SYSEX, 0, 0),
+	//System real-time messages
+	[0xF8]=ST(1, MIDI_CLASS_REALTIME, 0, MIDI_HANDLER_CLOCK, 0, 0),
+	[0xF9]=ST(1, MIDI_CLASS_UNDEFINED, 0, MIDI_HANDLER_SYSTEM, 0, 0),
+	[0xFA ... 0xFC]=ST(1, MIDI_CLASS_REALTIME, 0, MIDI_HANDLER_TRANSPORT, 0, 0),
+	[0xFD]=ST(1, MIDI_CLASS_UNDEFINED, 0, MIDI_HANDLER_SYSTEM, 0, 0),
+	[0xFE]=ST(1, MIDI_CLASS_REALTIME, 0, MIDI_HANDLER_IGNORE, 0, 0),
+	[0xFF]=ST(1, MIDI_CLASS_REALTIME, 0, MIDI_HANDLER_SYSTEM, 0, 0)
+};
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,82 @@
+/*
+ * ******************************************************************
+ * ZYNTHIAN PROJECT: ZynMidiRouter Library
+ * 
+ * MIDI status byte table: message length, class & handler
+ * 
+ * Copyright (C) 2015-2018 Fernando Moyano <jofemodo@zynthian.org>
+ *
+ * ******************************************************************
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * For a full copy of the GNU General Public License see the LICENSE.txt file.
+ * 
+ * ******************************************************************
+ */
+
+#ifndef ZYNMIDISTATUS_H
+#define ZYNMIDISTATUS_H
+
+#include <stdint.h>
+
+//-----------------------------------------------------------------------------
+// MIDI Status Table
+//-----------------------------------------------------------------------------
+// One entry for every status byte, so parsing an event is a single load.
+// Data bytes (0x00-0x7F) have class MIDI_CLASS_DATA & size 0. SysEx has
+// size 0 too, as its length is variable.
+//-----------------------------------------------------------------------------
+
+enum midi_status_class_enum {
+	MIDI_CLASS_DATA=0,
+	MIDI_CLASS_CHANNEL,
+	MIDI_CLASS_SYSEX,
+	MIDI_CLASS_COMMON,
+	MIDI_CLASS_REALTIME,
+	MIDI_CLASS_UNDEFINED
+};
+
+enum midi_status_handler_enum {
+	MIDI_HANDLER_NONE=0,
+	MIDI_HANDLER_NOTE_OFF,
+	MIDI_HANDLER_NOTE_ON,
+	MIDI_HANDLER_KEY_PRESS,
+	MIDI_HANDLER_CTRL_CHANGE,
+	MIDI_HANDLER_PROG_CHANGE,
+	MIDI_HANDLER_CHAN_PRESS,
+	MIDI_HANDLER_PITCH_BENDING,
+	MIDI_HANDLER_SYSEX,
+	MIDI_HANDLER_SYSTEM,
+	MIDI_HANDLER_CLOCK,
+	MIDI_HANDLER_TRANSPORT,
+	//Events dropped by the router (active sense)
+	MIDI_HANDLER_IGNORE
+};
+
+struct midi_status_st {
+	uint8_t size;
+	uint8_t class;
+	uint8_t channel;
+	uint8_t handler;
+	//Position of "num" & "val" bytes (0 => none)
+	uint8_t num_pos;
+	uint8_t val_pos;
+};
+
+extern const struct midi_status_st midi_status_table[256];
+
+#define MIDI_STATUS(status) (midi_status_table+(uint8_t)(status))
+#define MIDI_STATUS_SIZE(status) (midi_status_table[(uint8_t)(status)].size)
+
+#endif
+
+//-----------------------------------------------------------------------------
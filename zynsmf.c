@@ -0,0 +1,325 @@
+/*
+ * ******************************************************************
+ * ZYNTHIAN PROJECT: ZynMidiRouter Library
+ * 
+ * Standard MIDI File (SMF) helpers
+ * 
+ * Copyright (C) 2015-2018 Fernando Moyano <jofemodo@zynthian.org>
+ *
+ * ******************************************************************
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * For a full copy of the GNU General Public License see the LICENSE.txt file.
+ * 
+ * ******************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "zynsmf.h"
+#include "zynmidistatus.h"
+
+//-----------------------------------------------------------------------------
+// SMF Writing
+//-----------------------------------------------------------------------------
+
+void smf_write_uint32(uint8_t *buffer, uint32_t val) {
+	buffer[0]=(val >> 24) & 0xFF;
+	buffer[1]=(val >> 16) & 0xFF;
+	buffer[2]=(val >> 8) & 0xFF;
+	buffer[3]=val & 0xFF;
+}
+
+void smf_write_uint16(uint8_t *buffer, uint16_t val) {
+	buffer[0]=(val >> 8) & 0xFF;
+	buffer[1]=val & 0xFF;
+}
+
+//Write "MThd" chunk => Return number of bytes written
+int smf_write_header(uint8_t *buffer, uint16_t format, uint16_t n_tracks, uint16_t division) {
+	memcpy(buffer, "MThd", 4);
+	smf_write_uint32(buffer+4, 6);
+	smf_write_uint16(buffer+8, format);
+	smf_write_uint16(buffer+10, n_tracks);
+	smf_write_uint16(buffer+12, division);
+	return SMF_HEADER_SIZE;
+}
+
+//Write "MTrk" chunk header => Return number of bytes written
+int smf_write_track_header(uint8_t *buffer, uint32_t length) {
+	memcpy(buffer, "MTrk", 4);
+	smf_write_uint32(buffer+4, length);
+	return SMF_TRACK_HEADER_SIZE;
+}
+
+//Write variable-length quantity => Return number of bytes written (max 4)
+int smf_write_vlq(uint8_t *buffer, uint32_t val) {
+	uint8_t tmp[4];
+	int i, n=0;
+	val&=0x0FFFFFFF;
+	do {
+		tmp[n++]=val & 0x7F;
+		val>>=7;
+	} while (val>0);
+	for (i=0;i<n;i++) {
+		buffer[i]=tmp[n-1-i];
+		if (i<n-1) buffer[i]|=0x80;
+	}
+	return n;
+}
+
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// SMF Reading
+//-----------------------------------------------------------------------------
+
+uint32_t smf_read_uint32(const uint8_t *buffer) {
+	return ((uint32_t)buffer[0] << 24) | ((uint32_t)buffer[1] << 16) | ((uint32_t)buffer[2] << 8) | buffer[3];
+}
+
+uint16_t smf_read_uint16(const uint8_t *buffer) {
+	return ((uint16_t)buffer[0] << 8) | buffer[1];
+}
+
+//Read variable-length quantity => Return number of bytes read (0 if error)
+int smf_read_vlq(const uint8_t *buffer, const uint8_t *end, uint32_t *val) {
+	int n=0;
+	*val=0;
+	while (buffer+n<end && n<4) {
+		*val=(*val << 7) | (buffer[n] & 0x7F);
+		if (!(buffer[n++] & 0x80)) return n;
+	}
+	return 0;
+}
+
+//Read delta-time of next track event
+void smf_track_next(struct smf_track_st *track) {
+	uint32_t delta;
+	int n=smf_read_vlq(track->pos, track->end, &delta);
+	if (n==0) {
+		track->eot=1;
+		return;
+	}
+	track->pos+=n;
+	track->tick+=delta;
+}
+
+struct smf_st *smf_open(const char *fpath) {
+	struct stat st;
+	int fd=open(fpath, O_RDONLY);
+	if (fd<0) {
+		fprintf (stderr, "ZynMidiRouter: Can't open SMF file '%s'.\n", fpath);
+		return NULL;
+	}
+	if (fstat(fd, &st)<0 || st.st_size<SMF_HEADER_SIZE) {
+		fprintf (stderr, "ZynMidiRouter: Bad SMF file '%s'.\n", fpath);
+		close(fd);
+		return NULL;
+	}
+	uint8_t *map=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map==MAP_FAILED) {
+		fprintf (stderr, "ZynMidiRouter: Can't map SMF file '%s'.\n", fpath);
+		close(fd);
+		return NULL;
+	}
+	if (memcmp(map, "MThd", 4)!=0) {
+		fprintf (stderr, "ZynMidiRouter: Bad SMF header in '%s'.\n", fpath);
+		munmap(map, st.st_size);
+		close(fd);
+		return NULL;
+	}
+
+	struct smf_st *smf=malloc(sizeof(struct smf_st));
+	memset(smf, 0, sizeof(struct smf_st));
+	smf->fd=fd;
+	smf->map=map;
+	smf->map_size=st.st_size;
+	smf->format=smf_read_uint16(map+8);
+	smf->division=smf_read_uint16(map+12);
+	if (smf->division==0) smf->division=96;
+
+	//Locate tracks
+	const uint8_t *pos=map+8+smf_read_uint32(map+4);
+	const uint8_t *end=map+st.st_size;
+	uint16_t n_tracks=smf_read_uint16(map+10);
+	while (smf->n_tracks<n_tracks && smf->n_tracks<SMF_MAX_TRACKS && pos+SMF_TRACK_HEADER_SIZE<=end) {
+		uint32_t len=smf_read_uint32(pos+4);
+		const uint8_t *data=pos+SMF_TRACK_HEADER_SIZE;
+		if (len>end-data) len=end-data;
+		//Skip unknown chunks
+		if (memcmp(pos, "MTrk", 4)==0) {
+			struct smf_track_st *track=smf->tracks+smf->n_tracks++;
+			track->start=data;
+			track->end=data+len;
+		}
+		pos=data+len;
+	}
+	if (smf->n_tracks<n_tracks) {
+		fprintf (stderr, "ZynMidiRouter: Only %d of %d tracks loaded from SMF '%s'.\n", smf->n_tracks, n_tracks, fpath);
+	}
+	smf_rewind(smf);
+	return smf;
+}
+
+void smf_close(struct smf_st *smf) {
+	if (!smf) return;
+	munmap(smf->map, smf->map_size);
+	close(smf->fd);
+	free(smf);
+}
+
+void smf_rewind(struct smf_st *smf) {
+	int i;
+	for (i=0;i<smf->n_tracks;i++) {
+		struct smf_track_st *track=smf->tracks+i;
+		track->pos=track->start;
+		track->tick=0;
+		track->running_status=0;
+		track->port=-1;
+		track->eot=0;
+		smf_track_next(track);
+	}
+	smf->tempo=SMF_DEFAULT_TEMPO;
+	smf->tempo_tick=0;
+	smf->tempo_us=0;
+}
+
+//Ticks => Microseconds, using current tempo. Ticks must not be before the last tempo change.
+uint64_t smf_tick_to_us(struct smf_st *smf, uint32_t tick) {
+	//SMPTE division => fixed tick length
+	if (smf->division & 0x8000) {
+		uint64_t fps=-(int8_t)(smf->division >> 8);
+		uint64_t tpf=smf->division & 0xFF;
+		if (fps==29) return (uint64_t)tick*1001000/(30*tpf);
+		return (uint64_t)tick*1000000/(fps*tpf);
+	}
+	return smf->tempo_us + (uint64_t)(tick-smf->tempo_tick)*smf->tempo/smf->division;
+}
+
+int smf_next_event(struct smf_st *smf, struct smf_event_st *ev) {
+	while (1) {
+		//Get track with the earliest event
+		int i, it=-1;
+		for (i=0;i<smf->n_tracks;i++) {
+			if (smf->tracks[i].eot) continue;
+			if (it<0 || smf->tracks[i].tick<smf->tracks[it].tick) it=i;
+		}
+		if (it<0) return -1;
+		struct smf_track_st *track=smf->tracks+it;
+		if (track->pos>=track->end) {
+			track->eot=1;
+			continue;
+		}
+
+		//Get status byte
+		uint8_t status=*track->pos;
+		if (status & 0x80) track->pos++;
+		else if (track->running_status) status=track->running_status;
+		else {
+			track->eot=1;
+			continue;
+		}
+
+		//Meta-event
+		if (status==SMF_META) {
+			track->running_status=0;
+			if (track->pos>=track->end) {
+				track->eot=1;
+				continue;
+			}
+			uint8_t type=*track->pos++;
+			uint32_t len;
+			int n=smf_read_vlq(track->pos, track->end, &len);
+			if (n==0 || len>track->end-track->pos-n) {
+				track->eot=1;
+				continue;
+			}
+			const uint8_t *data=track->pos+n;
+			track->pos=data+len;
+			if (type==SMF_META_END_OF_TRACK) {
+				track->eot=1;
+				continue;
+			}
+			if (type==SMF_META_TEMPO && len==3) {
+				smf->tempo_us=smf_tick_to_us(smf, track->tick);
+				smf->tempo_tick=track->tick;
+				smf->tempo=((uint32_t)data[0] << 16) | ((uint32_t)data[1] << 8) | data[2];
+			}
+			else if (type==SMF_META_PORT && len==1) {
+				track->port=data[0];
+			}
+			smf_track_next(track);
+			continue;
+		}
+		//SysEx => skip
+		if (status==0xF0 || status==0xF7) {
+			track->running_status=0;
+			uint32_t len;
+			int n=smf_read_vlq(track->pos, track->end, &len);
+			if (n==0 || len>track->end-track->pos-n) {
+				track->eot=1;
+				continue;
+			}
+			track->pos+=n+len;
+			smf_track_next(track);
+			continue;
+		}
+
+		//MIDI message
+		int size=MIDI_STATUS_SIZE(status);
+		if (status<0xF0) track->running_status=status;
+		if (size-1>track->end-track->pos) {
+			track->eot=1;
+			continue;
+		}
+		//Data bytes with bit 7 set => corrupted track
+		if ((size>1 && (track->pos[0] & 0x80)) || (size>2 && (track->pos[1] & 0x80))) {
+			track->eot=1;
+			continue;
+		}
+		ev->data[0]=status;
+		memcpy(ev->data+1, track->pos, size-1);
+		track->pos+=size-1;
+		ev->size=size;
+		ev->tick=track->tick;
+		ev->time_us=smf_tick_to_us(smf, track->tick);
+		ev->track=it;
+		ev->port=track->port;
+		smf_track_next(track);
+		return 0;
+	}
+}
+
+uint64_t smf_get_length_us(struct smf_st *smf) {
+	struct smf_event_st ev;
+	int i;
+	smf_rewind(smf);
+	while (smf_next_event(smf, &ev)==0);
+	//Tracks stop at their end-of-track tick & the tempo map is at its last change
+	uint32_t end_tick=0;
+	for (i=0;i<smf->n_tracks;i++) {
+		if (smf->tracks[i].tick>end_tick) end_tick=smf->tracks[i].tick;
+	}
+	uint64_t length=(end_tick>=smf->tempo_tick) ? smf_tick_to_us(smf, end_tick) : smf->tempo_us;
+	smf_rewind(smf);
+	return length;
+}
+
+//-----------------------------------------------------------------------------
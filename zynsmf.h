@@ -0,0 +1,99 @@
+/*
+ * ******************************************************************
+ * ZYNTHIAN PROJECT: ZynMidiRouter Library
+ * 
+ * Standard MIDI File (SMF) helpers
+ * 
+ * Copyright (C) 2015-2018 Fernando Moyano <jofemodo@zynthian.org>
+ *
+ * ******************************************************************
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * For a full copy of the GNU General Public License see the LICENSE.txt file.
+ * 
+ * ******************************************************************
+ */
+
+#include <stdint.h>
+
+//-----------------------------------------------------------------------------
+// SMF Writing
+//-----------------------------------------------------------------------------
+
+#define SMF_HEADER_SIZE 14
+#define SMF_TRACK_HEADER_SIZE 8
+
+// SMPTE division: 25 fps x 40 ticks per frame => 1 tick = 1 millisecond
+#define SMF_DIVISION_MS 0xE728
+
+// Meta-events
+#define SMF_META 0xFF
+#define SMF_META_PORT 0x21
+#define SMF_META_END_OF_TRACK 0x2F
+#define SMF_META_TEMPO 0x51
+
+int smf_write_header(uint8_t *buffer, uint16_t format, uint16_t n_tracks, uint16_t division);
+int smf_write_track_header(uint8_t *buffer, uint32_t length);
+int smf_write_vlq(uint8_t *buffer, uint32_t val);
+
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// SMF Reading => Memory-mapped file, tracks merged in tick order
+//-----------------------------------------------------------------------------
+
+#define SMF_MAX_TRACKS 64
+#define SMF_DEFAULT_TEMPO 500000
+
+struct smf_track_st {
+	const uint8_t *start;
+	const uint8_t *pos;
+	const uint8_t *end;
+	uint32_t tick;
+	uint8_t running_status;
+	int port;
+	int eot;
+};
+
+struct smf_st {
+	int fd;
+	uint8_t *map;
+	size_t map_size;
+	uint16_t format;
+	uint16_t n_tracks;
+	uint16_t division;
+	struct smf_track_st tracks[SMF_MAX_TRACKS];
+	//Tempo map state => microseconds at last tempo change
+	uint32_t tempo;
+	uint32_t tempo_tick;
+	uint64_t tempo_us;
+};
+
+struct smf_event_st {
+	uint64_t time_us;
+	uint32_t tick;
+	int track;
+	int port;
+	int size;
+	uint8_t data[3];
+};
+
+struct smf_st *smf_open(const char *fpath);
+void smf_close(struct smf_st *smf);
+void smf_rewind(struct smf_st *smf);
+uint64_t smf_tick_to_us(struct smf_st *smf, uint32_t tick);
+//Get next MIDI event (max. 3 bytes, SysEx is skipped) => 0 if OK, -1 if end of file
+int smf_next_event(struct smf_st *smf, struct smf_event_st *ev);
+//Song length, up to the last end-of-track => Rewinds the SMF
+uint64_t smf_get_length_us(struct smf_st *smf);
+
+//-----------------------------------------------------------------------------